@@ -14,13 +14,18 @@
 #include <FreeImage.h>
 #include <iostream>
 #include <iomanip>
+#include <algorithm>
+#include <array>
+#include <limits>
 #include <vector>
 #include <string>
+#include <cstring>
 #include <map>
 #include <unordered_map>
 #include <sstream>
 #include <fstream>
 #include <chrono>
+#include <memory>
 
 #include "project_constants.h"
 
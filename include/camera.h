@@ -18,10 +18,14 @@ public:
    [[nodiscard]] int getWidth() const { return Width; }
    [[nodiscard]] int getHeight() const { return Height; }
    [[nodiscard]] bool getMovingState() const { return IsMoving; }
+   [[nodiscard]] bool isReversedZ() const { return ReversedZ; }
+   [[nodiscard]] float getNearPlane() const { return NearPlane; }
+   [[nodiscard]] float getFarPlane() const { return FarPlane; }
    [[nodiscard]] glm::vec3 getCameraPosition() const { return CamPos; }
    [[nodiscard]] const glm::mat4& getViewMatrix() const { return ViewMatrix; }
    [[nodiscard]] const glm::mat4& getProjectionMatrix() const { return ProjectionMatrix; }
    void setMovingState(bool is_moving) { IsMoving = is_moving; }
+   void setReversedZ(bool reversed_z);
    void updateCamera();
    void pitch(int angle);
    void yaw(int angle);
@@ -36,6 +40,26 @@ public:
    void zoomOut();
    void resetCamera();
    void updateWindowSize(int width, int height);
+   void updateProjection(float fov, float aspect_ratio, float near_plane, float far_plane);
+   [[nodiscard]] glm::vec3 getViewDirection() const { return -glm::vec3(ViewMatrix[0][2], ViewMatrix[1][2], ViewMatrix[2][2]); }
+   [[nodiscard]] std::array<glm::vec3, 8> getFrustumSliceCorners(float near_distance, float far_distance) const;
+   [[nodiscard]] glm::vec4 getFrustumSliceBoundingSphere(float near_distance, float far_distance) const;
+   [[nodiscard]] static glm::mat4 getPerspectiveProjection(
+      float fov_in_radians,
+      float aspect_ratio,
+      float near_plane,
+      float far_plane,
+      bool reversed_z
+   );
+   [[nodiscard]] static glm::mat4 getOrthographicProjection(
+      float left,
+      float right,
+      float bottom,
+      float top,
+      float near_plane,
+      float far_plane,
+      bool reversed_z
+   );
    void updateCameraPosition(
       const glm::vec3& cam_position,
       const glm::vec3& view_reference_position,
@@ -44,6 +68,7 @@ public:
 
 private:
    bool IsMoving;
+   bool ReversedZ; // the near plane maps to the depth 1 and the far plane to 0
    int Width;
    int Height;
    float FOV;
@@ -60,4 +85,6 @@ private:
    glm::vec3 CamPos;
    glm::mat4 ViewMatrix;
    glm::mat4 ProjectionMatrix;
+
+   void updateProjectionMatrix();
 };
\ No newline at end of file
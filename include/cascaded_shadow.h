@@ -0,0 +1,90 @@
+#pragma once
+
+#include "light.h"
+
+class CascadedShadowGL final
+{
+public:
+   inline static constexpr int CascadeNum = 4;
+
+   // The layout of this structure matches CascadeInfo in the std430 cascade buffer of the shaders.
+   // SplitDistances are the far distances of the cascades from the main camera.
+   struct CascadeInfo
+   {
+      glm::mat4 ViewProjectionMatrices[CascadeNum];
+      glm::vec4 SplitDistances;
+      int FirstLayer;
+      int HasShadow;
+      int Padding[2];
+   };
+
+   explicit CascadedShadowGL(
+      int map_size = 2048,
+      int max_light_num = 2,
+      float shadow_distance = 3000.0f,
+      GLenum depth_format = GL_DEPTH_COMPONENT32F
+   );
+   ~CascadedShadowGL();
+
+   void createShadowMaps();
+   void recreateShadowMaps(int map_size, GLenum depth_format, bool reversed_z);
+   void updateCascades(
+      const LightGL* lights,
+      const CameraGL* camera,
+      const glm::vec2& visible_depth_range,
+      const std::array<glm::vec3, 2>& scene_bounds
+   );
+   void transferUniformsToShader(const ShaderGL* shader) const;
+   void transferLightUniformsToShader(const ShaderGL* shader, int light_index) const;
+   void setWarping(bool use_warping) { UseWarping = use_warping; }
+   [[nodiscard]] bool isWarping() const { return UseWarping; }
+   [[nodiscard]] int getMapSize() const { return MapSize; }
+   [[nodiscard]] GLuint getFramebuffer() const { return FBO; }
+   [[nodiscard]] const glm::mat4* getViewProjectionMatrices(int light_index) const
+   {
+      return Cascades[light_index].ViewProjectionMatrices;
+   }
+   [[nodiscard]] bool hasCascades(int light_index) const
+   {
+      return light_index < static_cast<int>(Cascades.size()) && Cascades[light_index].HasShadow != 0;
+   }
+
+private:
+   // The weight of the logarithmic split against the uniform split.
+   inline static constexpr float SplitLambda = 0.75f;
+   // The warp falls back to the uniform cascade when the view is closer to the light direction than this sine,
+   // because the perspective along the view would degenerate.
+   inline static constexpr float MinWarpSine = 0.1f;
+   // The split range moves in steps of this ratio, so that the cascades keep their size while the view moves.
+   inline static constexpr float SplitRangeStep = 1.25f;
+
+   int MapSize;
+   int MaxLightNum;
+   int CascadeCapacity;
+   float ShadowDistance;
+   GLenum DepthFormat;
+   bool ReversedZ;
+   bool UseWarping; // the cascades are warped by the light space perspective of the view
+   GLuint FBO;
+   GLuint DepthArrayID;
+   GLuint CascadeBuffer;
+   glm::ivec2 SplitRangeSteps; // the near and far distances of the splits as the exponents of SplitRangeStep
+   std::vector<CascadeInfo> Cascades;
+
+   [[nodiscard]] std::array<float, CascadeNum> getSplitDistances(float near_plane, float far_plane) const;
+   void updateSplitRange(const glm::vec2& visible_depth_range);
+   [[nodiscard]] glm::mat4 getCascadeViewProjection(
+      const glm::vec3& light_direction,
+      const glm::vec4& bounding_sphere,
+      const std::array<glm::vec3, 2>& scene_bounds
+   ) const;
+   [[nodiscard]] glm::mat4 getWarpedCascadeViewProjection(
+      const glm::vec3& light_direction,
+      const CameraGL* camera,
+      float near_distance,
+      float far_distance,
+      const std::array<glm::vec3, 2>& scene_bounds
+   ) const;
+   void deleteShadowMaps();
+   void reserveCascadeBuffer();
+};
\ No newline at end of file
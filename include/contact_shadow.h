@@ -0,0 +1,42 @@
+#pragma once
+
+#include "light.h"
+
+class ContactShadowGL final
+{
+public:
+   // This should match CONTACT_LIGHT_NUM of the shaders. Each of the first lights gets a channel of the factors.
+   inline static constexpr int ContactLightNum = 4;
+
+   explicit ContactShadowGL(int step_num = 8, float ray_length = 6.0f, float thickness = 2.0f);
+   ~ContactShadowGL();
+
+   void resize(int width, int height);
+   void march(const ShaderGL* contact_shader, GLuint depth_texture, const LightGL* lights) const;
+   void setDepthView(const CameraGL* camera);
+   void transferUniformsToShader(const ShaderGL* shader) const;
+   void setEnabled(bool enabled) { Enabled = enabled; }
+   void setStepNum(int step_num) { StepNum = std::max( step_num, 1 ); }
+   [[nodiscard]] bool isEnabled() const { return Enabled; }
+   [[nodiscard]] bool hasDepthView() const { return HasDepthView; }
+   [[nodiscard]] int getStepNum() const { return StepNum; }
+
+private:
+   inline static constexpr int ThreadGroupSize = 8;
+
+   bool Enabled;
+   bool HasDepthView; // the depth of the previous frame is in the main target and its view is kept
+   bool DepthReversedZ;
+   int StepNum;
+   float RayLength; // how far the rays are marched toward the lights in the world space
+   float Thickness; // how far behind the depth buffer a surface is assumed to extend
+   int Width;
+   int Height;
+   GLuint FactorTextureID; // the contact shadow factors of the lights at the half resolution
+   GLuint DepthTextureID; // the linear depth of the half resolution pixels, which guides the upsampling
+   glm::mat4 DepthViewMatrix;
+   glm::mat4 DepthProjectionMatrix;
+   glm::mat4 ReprojectionMatrix; // to the half resolution texels of the depth view, with the view depth in w
+
+   void deleteTextures();
+};
\ No newline at end of file
@@ -0,0 +1,40 @@
+#pragma once
+
+#include "camera.h"
+#include "shader.h"
+
+class DepthBoundsGL final
+{
+public:
+   DepthBoundsGL();
+   ~DepthBoundsGL();
+
+   void resize(int width, int height);
+   void reduce(const ShaderGL* reduction_shader, const CameraGL* camera);
+   void collectBounds();
+   void blitToScreen() const;
+   [[nodiscard]] GLuint getFramebuffer() const { return FBO; }
+   [[nodiscard]] GLuint getDepthTextureID() const { return DepthTextureID; }
+   [[nodiscard]] bool hasBounds() const { return HasBounds; }
+   [[nodiscard]] const glm::vec2& getVisibleDepthRange() const { return VisibleDepthRange; }
+
+private:
+   inline static constexpr int ThreadGroupSize = 16;
+
+   // The bounds are read one or more frames late, so they are widened for the camera to move meanwhile.
+   inline static constexpr float DepthMargin = 0.1f;
+
+   bool HasBounds;
+   int Width;
+   int Height;
+   GLuint FBO;
+   GLuint ColorTextureID;
+   GLuint DepthTextureID;
+   GLuint BoundsBuffer;
+   GLuint ReadbackBuffer;
+   GLsync ReadbackFence;
+   glm::mat4 ReadbackProjection; // the projection of the frame whose bounds are being read back
+   glm::vec2 VisibleDepthRange;
+
+   void deleteTargets();
+};
\ No newline at end of file
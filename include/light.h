@@ -1,15 +1,45 @@
 #pragma once
 
-#include "shader.h"
+#include "object.h"
 
 class LightGL final
 {
 public:
+   // The layout of this structure matches LightInfo in the std430 light buffer of the shaders.
+   struct LightInfo
+   {
+      glm::vec4 Position;
+      glm::vec4 AmbientColor;
+      glm::vec4 DiffuseColor;
+      glm::vec4 SpecularColor;
+      glm::vec3 SpotlightDirection;
+      float SpotlightCutoffAngle;
+      float SpotlightFeather;
+      float FallOffRadius;
+      int LightSwitch;
+      float ShadowNormalOffset; // in texels of the shadow map at the receiver
+   };
+
+   // The light array follows this header in the light buffer.
+   struct LightBufferHeader
+   {
+      glm::vec4 GlobalAmbientColor;
+      int UseLight;
+      int LightNum;
+      int Padding[2];
+   };
+
+   // A spotlight with a narrow cone is shadowed by a tile of the shadow atlas and a point light by a cube map,
+   // or by a pair of paraboloid maps when its shadow should be cheap. A directional light has cascades.
+   enum class ShadowType { None = 0, Spot, CubeMap, DualParaboloid, Cascaded };
+
    LightGL();
-   ~LightGL() = default;
+   ~LightGL();
 
    [[nodiscard]] bool isLightOn() const;
+   [[nodiscard]] bool isLightClusteringOn() const { return UseLightClusters; }
    void toggleLightSwitch();
+   void toggleLightClustering() { UseLightClusters = !UseLightClusters; }
    void addLight(
       const glm::vec4& light_position,
       const glm::vec4& ambient_color = glm::vec4(0.0f, 0.0f, 0.0f, 1.0f),
@@ -22,26 +52,104 @@ public:
    );
    void setLightPosition(const glm::vec4& light_position, int index)
    {
-      assert( 0 <= index && index < Positions.size() );
-      Positions[index] = light_position;
+      assert( 0 <= index && index < TotalLightNum );
+      Lights[index].Position = light_position;
+      IsDirty[index] = true;
+      ShadowDirty[index] = true;
+   }
+   void setShadowCaster(int light_index, bool casts_shadow)
+   {
+      assert( 0 <= light_index && light_index < TotalLightNum );
+      ShadowCasters[light_index] = casts_shadow;
+      ShadowDirty[light_index] = true;
+   }
+   // The slope-scaled and the constant bias are the factor and the units of the polygon offset in the depth pass,
+   // and the normal offset moves the receiver along its normal before it looks up the shadow.
+   void setShadowBias(int light_index, float slope_scale, float constant, float normal_offset)
+   {
+      assert( 0 <= light_index && light_index < TotalLightNum );
+      ShadowDepthBiases[light_index] = glm::vec2(slope_scale, constant);
+      Lights[light_index].ShadowNormalOffset = normal_offset;
+      IsDirty[light_index] = true;
+      ShadowDirty[light_index] = true;
+   }
+   void setDualParaboloidShadow(int light_index, bool use_dual_paraboloid)
+   {
+      assert( 0 <= light_index && light_index < TotalLightNum );
+      DualParaboloidShadows[light_index] = use_dual_paraboloid;
+      ShadowDirty[light_index] = true;
    }
    void activateLight(const int& light_index);
    void deactivateLight(const int& light_index);
-   void transferUniformsToShader(const ShaderGL* shader);
+   void updateLightBuffer();
+   void buildLightClusters(const ShaderGL* clustering_shader, const CameraGL* camera);
+   void cullLights(const std::vector<ObjectGL*>& objects);
+   void transferUniformsToShader(const ShaderGL* shader) const;
    [[nodiscard]] int getTotalLightNum() const { return TotalLightNum; }
-   [[nodiscard]] glm::vec4 getLightPosition(int light_index) { return Positions[light_index]; }
+   [[nodiscard]] glm::vec4 getLightPosition(int light_index) const { return Lights[light_index].Position; }
+   [[nodiscard]] const LightInfo& getLight(int light_index) const { return Lights[light_index]; }
+   [[nodiscard]] bool isShadowCaster(int light_index) const
+   {
+      return ShadowCasters[light_index] && Lights[light_index].LightSwitch != 0;
+   }
+   [[nodiscard]] bool usesDualParaboloidShadow(int light_index) const { return DualParaboloidShadows[light_index]; }
+   [[nodiscard]] const glm::vec2& getShadowDepthBias(int light_index) const { return ShadowDepthBiases[light_index]; }
+   [[nodiscard]] ShadowType getShadowType(int light_index) const;
+   [[nodiscard]] bool isShadowDirty(int light_index) const { return ShadowDirty[light_index]; }
+   void clearShadowDirty() { std::fill( ShadowDirty.begin(), ShadowDirty.end(), false ); }
+   [[nodiscard]] GLuint getLightBuffer() const { return LightBuffer; }
+   [[nodiscard]] static float getInfluenceRadius(float falloff_radius) { return falloff_radius / std::sqrt( MinAttenuation ); }
 
 private:
+   // The bounding volumes of the lights in the structure-of-arrays layout for the SIMD culling.
+   // They are padded to a multiple of 4 with volumes which never pass the test.
+   struct LightVolumes
+   {
+      std::vector<float> X, Y, Z, Radius;
+      std::vector<float> DirectionX, DirectionY, DirectionZ, CosCutoff, SinCutoff;
+   };
+
+   // The light is regarded to have no effect beyond the distance where its attenuation drops below this.
+   inline static constexpr float MinAttenuation = 1.0f / 256.0f;
+   // A spotlight wider than this cannot be covered by a single perspective projection.
+   inline static constexpr float MaxSpotShadowCutoffAngle = 75.0f;
+   inline static constexpr float DefaultSlopeScaledBias = 2.0f;
+   inline static constexpr float DefaultConstantBias = 1.0f;
+   inline static constexpr float DefaultNormalOffset = 1.0f;
+   // These should match the work group size and the dispatch of LightClustering.comp.
+   inline static constexpr int ClusterGridX = 16;
+   inline static constexpr int ClusterGridY = 9;
+   inline static constexpr int ClusterGridZ = 24;
+   inline static constexpr int ClusterNum = ClusterGridX * ClusterGridY * ClusterGridZ;
+   inline static constexpr int AverageLightsPerCluster = 32;
+
    bool TurnLightOn;
+   bool IsHeaderDirty;
+   bool UseLightClusters;
    int TotalLightNum;
+   int LightCapacity;
+   GLuint LightBuffer;
+   GLuint ClusterBuffer;
+   GLuint ClusterLightIndexBuffer;
+   GLuint ObjectLightIndexBuffer;
+   int ObjectLightIndexCapacity;
+   glm::vec2 ClusterTileSize;
+   glm::vec2 ClusterDepthRange;
    glm::vec4 GlobalAmbientColor;
-   std::vector<bool> IsActivated;
-   std::vector<glm::vec4> Positions;
-   std::vector<glm::vec4> AmbientColors;
-   std::vector<glm::vec4> DiffuseColors;
-   std::vector<glm::vec4> SpecularColors;
-   std::vector<glm::vec3> SpotlightDirections;
-   std::vector<float> SpotlightCutoffAngles;
-   std::vector<float> SpotlightFeathers;
-   std::vector<float> FallOffRadii;
+   std::vector<bool> IsDirty;
+   std::vector<bool> ShadowDirty; // the light has changed since its shadow map was rendered
+   std::vector<bool> ShadowCasters;
+   std::vector<bool> DualParaboloidShadows;
+   std::vector<glm::vec2> ShadowDepthBiases; // the slope-scaled and the constant bias of the polygon offset
+   std::vector<LightInfo> Lights;
+   std::vector<GLuint> ObjectLightIndices;
+   LightVolumes Volumes;
+
+   void reserveLightBuffer();
+   void createClusterBuffers();
+   void resizeLightVolumes();
+   void updateLightVolume(int light_index);
+   void cullLights(const glm::vec4& bounding_sphere, std::vector<GLuint>& light_indices) const;
+   void bindStorageBuffer(const ShaderGL* shader, const char* block_name, GLuint buffer) const;
+   void uploadLights(int begin, int end) const;
 };
\ No newline at end of file
@@ -0,0 +1,34 @@
+#pragma once
+
+#include "shadow_atlas.h"
+
+class MomentShadowGL final
+{
+public:
+   // These should match MOMENT_SHADOW of the shaders.
+   // The exponential variance shadow maps keep 2 warped depths and their squares in floats,
+   // and the moment shadow maps keep the first 4 powers of the depth quantized to 16 bits.
+   enum class Type { None = 0, Exponential, FourMoments };
+
+   explicit MomentShadowGL(int blur_radius = 2, float light_bleeding_reduction = 0.2f);
+   ~MomentShadowGL();
+
+   void createMomentAtlas(Type type, int atlas_size, int max_tile_size);
+   void deleteMomentAtlas();
+   void updateTile(const ShaderGL* moment_shader, const ShadowAtlasGL* shadow_atlas, int light_index) const;
+   void generateMipmaps() const;
+   void transferUniformsToShader(const ShaderGL* shader) const;
+   [[nodiscard]] Type getType() const { return MomentType; }
+   [[nodiscard]] GLenum getMomentFormat() const { return MomentType == Type::FourMoments ? GL_RGBA16 : GL_RGBA32F; }
+
+private:
+   // The coarser levels would mix the neighbor tiles of the smallest tiles too much.
+   inline static constexpr int MomentLevelNum = 4;
+   inline static constexpr int ThreadGroupSize = 8;
+
+   Type MomentType;
+   int BlurRadius;
+   float LightBleedingReduction; // the part of the upper bound which is cut off as light bleeding
+   GLuint MomentAtlasID;
+   GLuint HorizontalMomentsID; // a tile blurred only horizontally
+};
\ No newline at end of file
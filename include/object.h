@@ -70,6 +70,38 @@ public:
    [[nodiscard]] GLsizei getVertexNum() const { return VerticesCount; }
    [[nodiscard]] GLuint getTextureID(int index) const { return TextureID[index]; }
    [[nodiscard]] int getTextureNum() const { return static_cast<int>(TextureID.size()); }
+   [[nodiscard]] const glm::mat4& getWorldMatrix() const { return WorldMatrix; }
+   [[nodiscard]] glm::vec4 getBoundingSphereInWorld() const;
+   [[nodiscard]] bool isStatic() const { return IsStatic; }
+   [[nodiscard]] bool isDirty() const { return IsDirty; }
+   [[nodiscard]] bool isShadowCaster() const { return IsShadowCaster; }
+   [[nodiscard]] bool isShadowReceiver() const { return IsShadowReceiver; }
+   void setWorldMatrix(const glm::mat4& world_matrix)
+   {
+      WorldMatrix = world_matrix;
+      IsDirty = true;
+   }
+   void setStatic(bool is_static)
+   {
+      IsStatic = is_static;
+      IsDirty = true;
+   }
+   void setShadowCaster(bool is_shadow_caster)
+   {
+      IsShadowCaster = is_shadow_caster;
+      IsDirty = true;
+   }
+   void setShadowReceiver(bool is_shadow_receiver)
+   {
+      IsShadowReceiver = is_shadow_receiver;
+      IsDirty = true;
+   }
+   void clearDirty() { IsDirty = false; }
+   void setLightIndexRange(int offset, int light_num)
+   {
+      LightIndexOffset = offset;
+      LightIndexNum = light_num;
+   }
 
    template<typename T>
    void addShaderStorageBufferObject(const std::string& name, GLuint binding_index, int data_size)
@@ -106,6 +138,10 @@ public:
    }
 
 private:
+   bool IsStatic;
+   bool IsDirty; // the transformation or the geometry has changed since the shadows were rendered
+   bool IsShadowCaster; // the object is rendered into the shadow maps
+   bool IsShadowReceiver; // the object is shadowed, and the casters are culled by the volume of the receivers
    uint8_t* ImageBuffer;
    std::vector<GLfloat> DataBuffer;
    GLuint VAO;
@@ -114,6 +150,10 @@ private:
    std::vector<GLuint> TextureID;
    std::map<std::string, GLuint> CustomBuffers;
    GLsizei VerticesCount;
+   int LightIndexOffset;
+   int LightIndexNum;
+   glm::vec4 BoundingSphere; // the center and radius in the object coordinates
+   glm::mat4 WorldMatrix;
    glm::vec4 EmissionColor;
    glm::vec4 AmbientReflectionColor; // It is usually set to the same color with DiffuseReflectionColor.
                                      // Otherwise, it should be in balance with DiffuseReflectionColor.
@@ -125,6 +165,7 @@ private:
    void prepareTexture(bool normals_exist) const;
    void prepareVertexBuffer(int n_bytes_per_vertex);
    void prepareNormal() const;
+   void updateBoundingSphere(int n_floats_per_vertex);
    static void getSquareObject(
       std::vector<glm::vec3>& vertices,
       std::vector<glm::vec3>& normals,
@@ -0,0 +1,73 @@
+#pragma once
+
+#include "light.h"
+
+class PointShadowGL final
+{
+public:
+   // The layout of this structure matches PointShadowInfo in the std430 point shadow buffer of the shaders.
+   // Position is where the light was when its map was rendered, DepthRange is the near and far distance from it,
+   // and Type is the LightGL::ShadowType of the light.
+   struct PointShadowInfo
+   {
+      glm::vec4 Position;
+      glm::vec2 DepthRange;
+      int Layer;
+      int Type;
+   };
+
+   explicit PointShadowGL(int map_size = 1024, int max_light_num = 4, GLenum depth_format = GL_DEPTH_COMPONENT32F);
+   ~PointShadowGL();
+
+   void createShadowMaps();
+   void recreateShadowMaps(int map_size, GLenum depth_format, bool reversed_z);
+   void assignLayers(const LightGL* lights, const std::array<glm::vec3, 2>& scene_bounds);
+   void uploadShadowBuffer();
+   void updateShadowProjection(int light_index, const LightGL* lights);
+   void clearStaticLayers(int light_index) const;
+   void copyStaticLayers(int light_index) const;
+   void transferUniformsToShader(const ShaderGL* shader) const;
+   void transferLightUniformsToShader(const ShaderGL* shader, int light_index) const;
+   [[nodiscard]] int getMapSize() const { return MapSize; }
+   [[nodiscard]] GLuint getFramebuffer(LightGL::ShadowType type, bool for_static_casters) const
+   {
+      if (type == LightGL::ShadowType::CubeMap) return for_static_casters ? StaticCubeMapFBO : CubeMapFBO;
+      return for_static_casters ? StaticParaboloidFBO : ParaboloidFBO;
+   }
+   [[nodiscard]] bool isLayerChanged(int light_index) const { return ChangedLayers[light_index]; }
+   [[nodiscard]] bool isDepthRangeChanged(int light_index) const { return ChangedDepthRanges[light_index]; }
+   [[nodiscard]] LightGL::ShadowType getShadowType(int light_index) const
+   {
+      return light_index < static_cast<int>(Shadows.size()) ?
+         static_cast<LightGL::ShadowType>(Shadows[light_index].Type) : LightGL::ShadowType::None;
+   }
+   [[nodiscard]] std::array<glm::mat4, 6> getCubeViewProjections(const glm::vec3& light_position, const glm::vec2& depth_range) const;
+
+private:
+   inline static constexpr float NearPlane = 1.0f;
+
+   int MapSize;
+   int MaxLightNum;
+   int ShadowCapacity;
+   GLenum DepthFormat;
+   bool ReversedZ; // the maps store 1 minus the normalized distance, so they are cleared to 0 and compared with GEQUAL
+   GLuint CubeMapFBO;
+   GLuint ParaboloidFBO;
+   GLuint CubeMapArrayID;
+   GLuint ParaboloidArrayID;
+   GLuint StaticCubeMapFBO;
+   GLuint StaticParaboloidFBO;
+   GLuint StaticCubeMapArrayID; // the depth of the static casters, which the shadow maps start from every frame
+   GLuint StaticParaboloidArrayID;
+   GLuint ShadowBuffer;
+   std::vector<PointShadowInfo> Shadows;
+   std::vector<bool> ChangedLayers;
+   std::vector<bool> ChangedDepthRanges;
+   std::vector<glm::vec2> FittedDepthRanges; // the range the next refresh renders with
+
+   void createDepthArray(GLuint& texture, GLuint& framebuffer, GLenum target, int layer_num) const;
+   void deleteShadowMaps();
+   [[nodiscard]] GLuint getDepthArray(int light_index, bool for_static_casters) const;
+
+   void reserveShadowBuffer();
+};
\ No newline at end of file
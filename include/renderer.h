@@ -10,8 +10,14 @@
 #pragma once
 
 #include "base.h"
-#include "light.h"
-#include "object.h"
+#include "shadow_atlas.h"
+#include "point_shadow.h"
+#include "cascaded_shadow.h"
+#include "depth_bounds.h"
+#include "moment_shadow.h"
+#include "shadow_scheduler.h"
+#include "virtual_shadow.h"
+#include "contact_shadow.h"
 
 class RendererGL
 {
@@ -28,22 +34,71 @@ public:
    void play();
 
 private:
+   // The field of view of a spotlight shadow is fitted in steps of this many degrees.
+   inline static constexpr float ShadowFovStep = 2.5f;
+
+   // The shadow map resolution is the size of the shadow atlas. The point light and cascade maps follow it.
+   inline static constexpr int MinShadowMapSize = 512;
+   inline static constexpr int MaxShadowMapSize = 8192;
+   inline static constexpr std::array<GLenum, 3> ShadowDepthFormats{
+      GL_DEPTH_COMPONENT16, GL_DEPTH_COMPONENT24, GL_DEPTH_COMPONENT32F
+   };
+
+   // The casters are culled by the receivers extruded toward the light. A point light extrudes them into the cone
+   // from its position, and the other lights extrude them through their view projections.
+   struct CasterCullingVolume
+   {
+      std::array<glm::vec3, 2> ReceiverBounds;
+      std::vector<glm::mat4> LightViewProjections; // empty for a point light
+      glm::vec3 LightPosition;
+
+      CasterCullingVolume(const std::array<glm::vec3, 2>& receiver_bounds, std::vector<glm::mat4> light_view_projections) :
+         ReceiverBounds( receiver_bounds ), LightViewProjections( std::move( light_view_projections ) ), LightPosition( 0.0f ) {}
+      CasterCullingVolume(const std::array<glm::vec3, 2>& receiver_bounds, const glm::vec3& light_position) :
+         ReceiverBounds( receiver_bounds ), LightPosition( light_position ) {}
+   };
+
    inline static RendererGL* Renderer = nullptr;
    GLFWwindow* Window;
    int FrameWidth;
    int FrameHeight;
-   GLuint FBO;
-   GLuint DepthTextureID;
    glm::ivec2 ClickedPoint;
    float LightTheta;
+   int ShadowMapSize;
+   int ShadowDepthFormatIndex;
+   int PCFKernelSize;
+   bool UseSoftShadows;
+   int BlockerSearchSampleNum;
+   int SoftShadowFilterSampleNum;
+   float LightSize;
+   MomentShadowGL::Type MomentShadowType;
+   bool UseReversedZ;
+   bool UseReceiverPlaneBias;
    std::unique_ptr<CameraGL> MainCamera;
    std::unique_ptr<CameraGL> LightCamera;
    std::unique_ptr<ShaderGL> ObjectShader;
    std::unique_ptr<ShaderGL> ShadowShader;
+   std::unique_ptr<ShaderGL> LightClusteringShader;
+   std::unique_ptr<ShaderGL> CubeShadowShader;
+   std::unique_ptr<ShaderGL> ParaboloidShadowShader;
+   std::unique_ptr<ShaderGL> CascadedShadowShader;
+   std::unique_ptr<ShaderGL> DepthBoundsShader;
+   std::unique_ptr<ShaderGL> ShadowMomentShader;
+   std::unique_ptr<ShaderGL> VirtualShadowShader;
+   std::unique_ptr<ShaderGL> PageMarkingShader;
+   std::unique_ptr<ShaderGL> ContactShadowShader;
    std::unique_ptr<ObjectGL> GroundObject;
    std::unique_ptr<ObjectGL> TigerObject;
    std::unique_ptr<ObjectGL> PandaObject;
    std::unique_ptr<LightGL> Lights;
+   std::unique_ptr<ShadowAtlasGL> ShadowAtlas;
+   std::unique_ptr<PointShadowGL> PointShadow;
+   std::unique_ptr<CascadedShadowGL> CascadedShadow;
+   std::unique_ptr<DepthBoundsGL> DepthBounds;
+   std::unique_ptr<MomentShadowGL> MomentShadow;
+   std::unique_ptr<ShadowSchedulerGL> ShadowScheduler;
+   std::unique_ptr<VirtualShadowGL> VirtualShadow;
+   std::unique_ptr<ContactShadowGL> ContactShadow;
 
    void registerCallbacks() const;
    void initialize();
@@ -56,16 +111,45 @@ private:
    static void mousewheel(GLFWwindow* window, double xoffset, double yoffset);
    static void reshape(GLFWwindow* window, int width, int height);
 
+   void setDepthConvention() const;
+   void createShadowShaders();
+   void setShadowMapQuality(int shadow_map_size, int depth_format_index);
+   [[nodiscard]] float getShadowDepthEpsilon() const;
+   void setShadowDepthBias(int light_index, const ShaderGL* point_shadow_shader = nullptr) const;
    void setLights() const;
    void setGroundObject() const;
    void setTigerObject() const;
    void setPandaObject() const;
-   void setDepthFrameBuffer();
 
    void drawGroundObject(ShaderGL* shader, CameraGL* camera) const;
    void drawTigerObject(ShaderGL* shader, CameraGL* camera) const;
    void drawPandaObject(ShaderGL* shader, CameraGL* camera) const;
-   void drawDepthMapFromLightView(int light_index) const;
-   void drawShadow(int light_index) const;
+   [[nodiscard]] bool areStaticCastersDirty() const;
+   [[nodiscard]] bool hasDynamicCasters() const;
+   [[nodiscard]] std::array<glm::vec3, 2> getReceiverBounds(bool visible_only) const;
+   [[nodiscard]] static bool overlapsExtrudedReceivers(
+      const glm::vec4& caster_sphere,
+      const glm::mat4& light_view_projection,
+      const std::array<glm::vec3, 2>& receiver_bounds,
+      bool reversed_z
+   );
+   [[nodiscard]] static bool overlapsReceiverCone(
+      const glm::vec4& caster_sphere,
+      const glm::vec3& light_position,
+      const std::array<glm::vec3, 2>& receiver_bounds
+   );
+   [[nodiscard]] bool isCasterNeeded(const ObjectGL* caster, const CasterCullingVolume& volume) const;
+   void drawCasters(ShaderGL* shader, CameraGL* camera, bool static_casters, const CasterCullingVolume& volume) const;
+   [[nodiscard]] glm::vec2 getVisibleDepthRange() const;
+   [[nodiscard]] std::array<glm::vec3, 2> getSceneBounds() const;
+   bool setLightCamera(int light_index) const;
+   void allocateShadowTiles() const;
+   [[nodiscard]] float getShadowImportance(int light_index) const;
+   [[nodiscard]] std::vector<bool> scheduleShadowUpdates() const;
+   void drawShadowAtlas(const std::vector<bool>& refreshing) const;
+   void drawPointShadowMaps(LightGL::ShadowType shadow_type, ShaderGL* shader, const std::vector<bool>& refreshing) const;
+   void drawCascadedShadowMaps() const;
+   void drawVirtualShadowPages() const;
+   void drawShadow() const;
    void render() const;
 };
\ No newline at end of file
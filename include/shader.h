@@ -6,28 +6,44 @@
 class ShaderGL
 {
 public:
-   struct LightLocationSet
+   // Indices into the flat location table.
+   enum LocationIndex
    {
-      GLint LightSwitch, LightPosition;
-      GLint LightAmbient, LightDiffuse, LightSpecular, LightFallOffRadius;
-      GLint SpotlightDirection, SpotlightCutoffAngle, SpotlightFeather;
+      WorldLoc = 0, ViewLoc, ProjectionLoc, ModelViewProjectionLoc,
+      MaterialEmissionLoc, MaterialAmbientLoc, MaterialDiffuseLoc, MaterialSpecularLoc, MaterialSpecularExponentLoc,
+      BaseTextureLoc, UseTextureLoc, ObjectLightIndexOffsetLoc, ObjectLightIndexNumLoc, ReceiveShadowsLoc,
+      LocationNum
+   };
+
+   struct UniformInfo
+   {
+      GLint Location;
+      GLenum Type;
+      GLint ArraySize;
+
+      UniformInfo() : Location( -1 ), Type( 0 ), ArraySize( 0 ) {}
+      UniformInfo(GLint location, GLenum type, GLint array_size) : Location( location ), Type( type ), ArraySize( array_size ) {}
+   };
 
-      LightLocationSet() : LightSwitch( 0 ), LightPosition( 0 ), LightAmbient( 0 ), LightDiffuse( 0 ),
-      LightSpecular( 0 ), LightFallOffRadius( 0 ), SpotlightDirection( 0 ), SpotlightCutoffAngle( 0 ),
-      SpotlightFeather( 0 ) {}
+   struct BlockInfo
+   {
+      GLint Binding;
+      GLint DataSize;
+
+      BlockInfo() : Binding( -1 ), DataSize( 0 ) {}
+      BlockInfo(GLint binding, GLint data_size) : Binding( binding ), DataSize( data_size ) {}
    };
 
-   struct LocationSet
+   // A compile-time constant of the shaders. It is a specialization constant of the SPIR-V binaries,
+   // and it is injected as a #define into the GLSL sources when they are compiled at runtime.
+   // A name keeps one ID across all shaders: PCF_KERNEL_SIZE 0, MOMENT_SHADOW 1, REVERSED_Z 2, and DUAL_PARABOLOID 3.
+   struct ShaderConstant
    {
-      GLint World, View, Projection, ModelViewProjection;
-      GLint MaterialEmission, MaterialAmbient, MaterialDiffuse, MaterialSpecular, MaterialSpecularExponent;
-      std::map<GLint, GLint> Texture; // <binding point, texture id>
-      GLint UseTexture, UseLight, LightNum, GlobalAmbient;
-      std::vector<LightLocationSet> Lights;
+      GLuint ID;
+      int Value;
 
-      LocationSet() : World( 0 ), View( 0 ), Projection( 0 ), ModelViewProjection( 0 ), MaterialEmission( 0 ),
-      MaterialAmbient( 0 ), MaterialDiffuse( 0 ), MaterialSpecular( 0 ), MaterialSpecularExponent( 0 ),
-      UseTexture( 0 ), UseLight( 0 ), LightNum( 0 ), GlobalAmbient( 0 ) {}
+      ShaderConstant() : ID( 0 ), Value( 0 ) {}
+      ShaderConstant(GLuint id, int value) : ID( id ), Value( value ) {}
    };
 
    ShaderGL();
@@ -41,11 +57,22 @@ public:
       const char* tessellation_evaluation_shader_path = nullptr
    );
    void setComputeShaders(const char* compute_shader_path);
+   void enableHotReload();
+   bool updateHotReload();
+   void setShaderConstant(const std::string& name, GLuint constant_id, int value)
+   {
+      ShaderConstants[name] = ShaderConstant( constant_id, value );
+   }
+   // The stages which have a binary built with the variant, <file>.<variant>.spv, load it instead of <file>.spv.
+   void setBinaryVariant(const std::string& variant) { BinaryVariant = variant; }
    void setBasicUniformLocations();
-   void setUniformLocations(int light_num);
+   void setUniformLocations();
    void addUniformLocation(const std::string& name)
    {
-      CustomLocations[name] = glGetUniformLocation( ShaderProgram, name.c_str() );
+      CustomLocations[name] = getUniformLocation( name );
+      if (CustomLocations[name] < 0) {
+         std::cerr << "Uniform '" << name << "' is not an active uniform of program " << ShaderProgram << "\n";
+      }
    }
    void transferBasicTransformationUniforms(const glm::mat4& to_world, const CameraGL* camera, bool use_texture = false) const;
    void uniform1i(const char* name, int value) const
@@ -85,60 +112,66 @@ public:
       glProgramUniformMatrix4fv( ShaderProgram, CustomLocations.find( name )->second, 1, GL_FALSE, &value[0][0] );
    }
    [[nodiscard]] GLuint getShaderProgram() const { return ShaderProgram; }
+   [[nodiscard]] bool isLoadedFromBinaries() const { return LoadedFromBinaries; }
    [[nodiscard]] GLint getLocation(const std::string& name) const { return CustomLocations.find( name )->second; }
-   [[nodiscard]] GLint getMaterialEmissionLocation() const { return Location.MaterialEmission; }
-   [[nodiscard]] GLint getMaterialAmbientLocation() const { return Location.MaterialAmbient; }
-   [[nodiscard]] GLint getMaterialDiffuseLocation() const { return Location.MaterialDiffuse; }
-   [[nodiscard]] GLint getMaterialSpecularLocation() const { return Location.MaterialSpecular; }
-   [[nodiscard]] GLint getMaterialSpecularExponentLocation() const { return Location.MaterialSpecularExponent; }
-   [[nodiscard]] GLint getLightAvailabilityLocation() const { return Location.UseLight; }
-   [[nodiscard]] GLint getLightNumLocation() const { return Location.LightNum; }
-   [[nodiscard]] GLint getGlobalAmbientLocation() const { return Location.GlobalAmbient; }
-   [[nodiscard]] GLint getLightSwitchLocation(int light_index) const
-   {
-      return Location.Lights[light_index].LightSwitch;
-   }
-   [[nodiscard]] GLint getLightPositionLocation(int light_index) const
-   {
-      return Location.Lights[light_index].LightPosition;
-   }
-   [[nodiscard]] GLint getLightAmbientLocation(int light_index) const
-   {
-      return Location.Lights[light_index].LightAmbient;
-   }
-   [[nodiscard]] GLint getLightDiffuseLocation(int light_index) const
-   {
-      return Location.Lights[light_index].LightDiffuse;
-   }
-   [[nodiscard]] GLint getLightSpecularLocation(int light_index) const
-   {
-      return Location.Lights[light_index].LightSpecular;
-   }
-   [[nodiscard]] GLint getLightSpotlightDirectionLocation(int light_index) const
-   {
-      return Location.Lights[light_index].SpotlightDirection;
-   }
-   [[nodiscard]] GLint getLightSpotlightCutoffAngleLocation(int light_index) const
+   [[nodiscard]] GLint getLocation(LocationIndex index) const { return Locations[index]; }
+   [[nodiscard]] bool isActiveUniform(const std::string& name) const { return ActiveUniforms.find( name ) != ActiveUniforms.end(); }
+   [[nodiscard]] GLint getUniformLocation(const std::string& name) const
    {
-      return Location.Lights[light_index].SpotlightCutoffAngle;
+      const auto it = ActiveUniforms.find( name );
+      return it == ActiveUniforms.end() ? -1 : it->second.Location;
    }
-   [[nodiscard]] GLint getLightSpotlightFeatherLocation(int light_index) const
+   [[nodiscard]] GLint getUniformBlockBinding(const std::string& name) const
    {
-      return Location.Lights[light_index].SpotlightFeather;
+      const auto it = UniformBlocks.find( name );
+      return it == UniformBlocks.end() ? -1 : it->second.Binding;
    }
-   [[nodiscard]] GLint getLightFallOffRadiusLocation(int light_index) const
+   [[nodiscard]] GLint getStorageBlockBinding(const std::string& name) const
    {
-      return Location.Lights[light_index].LightFallOffRadius;
+      const auto it = StorageBlocks.find( name );
+      return it == StorageBlocks.end() ? -1 : it->second.Binding;
    }
 
 protected:
+   bool LoadedFromBinaries;
+   bool ReloadRequested;
+   bool ParallelCompileSupported;
+   int WatchDescriptor;
+   bool UsesMaterialLocations;
    GLuint ShaderProgram;
-   LocationSet Location;
+   GLuint PendingProgram;
+   std::vector<std::pair<GLenum, GLuint>> PendingShaders;
+   std::map<int, std::string> WatchedDirectories;
+   std::vector<std::pair<GLenum, std::string>> ShaderFiles;
+   std::string BinaryVariant;
+   std::map<std::string, ShaderConstant> ShaderConstants;
+   std::vector<GLint> Locations;
    std::unordered_map<std::string, GLint> CustomLocations;
+   std::unordered_map<std::string, UniformInfo> ActiveUniforms;
+   std::unordered_map<std::string, BlockInfo> UniformBlocks;
+   std::unordered_map<std::string, BlockInfo> StorageBlocks;
 
    static void readShaderFile(std::string& shader_contents, const char* shader_path);
    [[nodiscard]] static std::string getShaderTypeString(GLenum shader_type);
+   [[nodiscard]] static bool isExtensionSupported(const std::string& extension);
    [[nodiscard]] static bool checkCompileError(GLenum shader_type, const GLuint& shader);
-   [[nodiscard]] static GLuint getCompiledShader(GLenum shader_type, const char* shader_path);
+   [[nodiscard]] static bool checkLinkError(const GLuint& program);
+   [[nodiscard]] static std::string getBinaryPath(const std::string& shader_path, const std::string& variant);
+   [[nodiscard]] static std::vector<GLuint> getSpecializationConstantIDs(const std::vector<char>& binary);
+   [[nodiscard]] GLuint getCompiledShader(GLenum shader_type, const std::string& shader_path) const;
+   [[nodiscard]] GLuint getSpecializedShader(GLenum shader_type, const std::string& shader_path) const;
+   [[nodiscard]] bool hasResourceNames() const;
+   void insertShaderConstants(std::string& shader_contents) const;
+   bool linkShaderProgram(bool use_binaries);
+   bool buildShaderProgram();
+   void updateLocations();
+   void readFileEvents();
+   void requestReload();
+   bool finishReload();
+   [[nodiscard]] std::string getResourceName(GLenum program_interface, GLuint index, GLint max_name_length) const;
+   void reflectShaderProgram();
+   void reflectActiveUniforms();
+   void reflectActiveBlocks(GLenum program_interface, std::unordered_map<std::string, BlockInfo>& blocks) const;
+   void setLocation(LocationIndex index, const char* name, bool optional = false);
    void setBasicTransformationUniforms();
 };
\ No newline at end of file
@@ -0,0 +1,93 @@
+#pragma once
+
+#include "light.h"
+
+class ShadowAtlasGL final
+{
+public:
+   // The layout of this structure matches ShadowInfo in the std430 shadow buffer of the shaders.
+   // AtlasRect is the offset and size of the tile in texture coordinates, and HasShadow is 0 for a light without a tile.
+   // TanHalfFov and DepthRange describe the projection of the light, so that the stored depth can be linearized.
+   struct ShadowInfo
+   {
+      glm::mat4 ViewProjectionMatrix;
+      glm::vec4 AtlasRect;
+      int HasShadow;
+      float TanHalfFov;
+      glm::vec2 DepthRange;
+   };
+
+   struct TileRequest
+   {
+      int LightIndex;
+      int TileSize;
+      glm::mat4 ViewProjectionMatrix;
+
+      TileRequest() : LightIndex( -1 ), TileSize( 0 ), ViewProjectionMatrix( 1.0f ) {}
+      TileRequest(int light_index, int tile_size, const glm::mat4& view_projection) :
+         LightIndex( light_index ), TileSize( tile_size ), ViewProjectionMatrix( view_projection ) {}
+   };
+
+   explicit ShadowAtlasGL(int atlas_size = 4096, int min_tile_size = 128, GLenum depth_format = GL_DEPTH_COMPONENT32F);
+   ~ShadowAtlasGL();
+
+   void createAtlas();
+   void recreateAtlas(int atlas_size, GLenum depth_format, bool reversed_z);
+   void allocateTiles(std::vector<TileRequest> requests, int light_num);
+   void uploadShadowBuffer();
+   void setLightProjection(int light_index, const CameraGL* light_camera);
+   void clearStaticTile(int light_index) const;
+   void copyStaticTile(int light_index) const;
+   void transferUniformsToShader(const ShaderGL* shader) const;
+   [[nodiscard]] int getTileSize(float screen_coverage) const;
+   void bindRawDepthTexture(GLuint unit) const;
+   [[nodiscard]] int getAtlasSize() const { return AtlasSize; }
+   [[nodiscard]] int getMaxTileSize() const { return MaxTileSize; }
+   [[nodiscard]] const glm::vec2& getDepthRange(int light_index) const { return Shadows[light_index].DepthRange; }
+   [[nodiscard]] GLuint getFramebuffer() const { return FBO; }
+   [[nodiscard]] GLuint getStaticFramebuffer() const { return StaticFBO; }
+   [[nodiscard]] GLuint getDepthTextureID() const { return DepthTextureID; }
+   [[nodiscard]] const glm::ivec4& getTile(int light_index) const { return Tiles[light_index]; }
+   [[nodiscard]] bool hasTile(int light_index) const
+   {
+      return light_index < static_cast<int>(Tiles.size()) && Tiles[light_index].z > 0;
+   }
+   [[nodiscard]] bool isTileChanged(int light_index) const { return ChangedTiles[light_index]; }
+   [[nodiscard]] bool isProjectionChanged(int light_index) const { return ChangedProjections[light_index]; }
+   [[nodiscard]] static float getScreenCoverage(const glm::vec3& center, float radius, const CameraGL* camera);
+
+private:
+   // A square region of the atlas. A node is either a free or used leaf, or it is split into 4 children.
+   struct QuadNode
+   {
+      glm::ivec2 Origin;
+      int Size;
+      bool Used;
+      int FirstChild;
+
+      QuadNode(const glm::ivec2& origin, int size) : Origin( origin ), Size( size ), Used( false ), FirstChild( -1 ) {}
+   };
+
+   int AtlasSize;
+   int MinTileSize;
+   int MaxTileSize;
+   int ShadowCapacity;
+   GLenum DepthFormat;
+   bool ReversedZ; // the tiles are rendered with the reversed depth, so they are cleared to 0 and compared with GEQUAL
+   GLuint FBO;
+   GLuint DepthTextureID;
+   GLuint StaticFBO;
+   GLuint StaticDepthTextureID; // the depth of the static casters, which the atlas starts from every frame
+   GLuint RawDepthSampler; // reads the atlas without the comparison
+   GLuint ShadowBuffer;
+   std::vector<QuadNode> Nodes;
+   std::vector<glm::ivec4> Tiles;
+   std::vector<bool> ChangedTiles;
+   std::vector<bool> ChangedProjections; // the requested matrix differs from the one the cached depth was rendered with
+   std::vector<ShadowInfo> Shadows;
+
+   static void createDepthTexture(GLuint& texture, GLuint& framebuffer, int size, GLenum depth_format, bool reversed_z);
+   void deleteAtlas();
+   int allocateNode(int node_index, int tile_size);
+   void reserveShadowBuffer();
+};
\ No newline at end of file
@@ -0,0 +1,51 @@
+#pragma once
+
+#include "base.h"
+
+class ShadowSchedulerGL final
+{
+public:
+   // A light whose shadow map could be refreshed this frame.
+   // A mandatory one has lost its cached map, so it is refreshed regardless of the budget.
+   struct Candidate
+   {
+      int LightIndex;
+      float Importance;
+      bool IsMoving;
+      bool IsMandatory;
+
+      Candidate() : LightIndex( -1 ), Importance( 0.0f ), IsMoving( false ), IsMandatory( false ) {}
+      Candidate(int light_index, float importance, bool is_moving, bool is_mandatory) :
+         LightIndex( light_index ), Importance( importance ), IsMoving( is_moving ), IsMandatory( is_mandatory ) {}
+   };
+
+   explicit ShadowSchedulerGL(float budget_in_ms = 2.0f);
+   ~ShadowSchedulerGL();
+
+   void setBudget(float budget_in_ms) { BudgetInMs = std::max( budget_in_ms, 0.0f ); }
+   void resize(int light_num);
+   void invalidate(int light_index) { StaticPending[light_index] = true; }
+   void collectTimings();
+   void beginUpdate(int light_index);
+   void endUpdate();
+   [[nodiscard]] std::vector<int> schedule(std::vector<Candidate> candidates);
+   [[nodiscard]] float getBudget() const { return BudgetInMs; }
+   [[nodiscard]] bool isStaticPending(int light_index) const { return StaticPending[light_index]; }
+
+private:
+   inline static constexpr float DefaultCostInMs = 0.5f;
+   inline static constexpr float CostSmoothing = 0.2f;
+   inline static constexpr float StalenessWeight = 0.25f;
+   inline static constexpr float MotionWeight = 2.0f;
+
+   float BudgetInMs;
+   int FrameIndex;
+   int ActiveLightIndex;
+   std::vector<int> LastUpdateFrames;
+   std::vector<float> CostsInMs;
+   std::vector<bool> StaticPending; // the static layer is stale until the light is refreshed
+   std::vector<GLuint> FreeQueries;
+   std::vector<std::pair<GLuint, int>> PendingQueries;
+
+   [[nodiscard]] float getCost(int light_index) const;
+};
\ No newline at end of file
@@ -0,0 +1,93 @@
+#pragma once
+
+#include "light.h"
+
+class VirtualShadowGL final
+{
+public:
+   // These should match the virtual shadow constants of the shaders.
+   // The virtual map of VirtualPageNum x VirtualPageNum pages spans the whole scene seen from the directional light.
+   inline static constexpr int PageSize = 128;
+   inline static constexpr int VirtualPageNum = 128;
+   inline static constexpr GLuint UnmappedPage = 0xFFFFFFFFu;
+
+   explicit VirtualShadowGL(int pool_size = 4096, int max_pages_per_frame = 64, GLenum depth_format = GL_DEPTH_COMPONENT32F);
+   ~VirtualShadowGL();
+
+   void createPool();
+   void recreatePool(GLenum depth_format, bool reversed_z);
+   void setEnabled(bool enabled);
+   void collectRequests();
+   void updatePages(const LightGL* lights, const std::array<glm::vec3, 2>& scene_bounds, const std::vector<ObjectGL*>& casters);
+   void transferPageUniformsToShader(const ShaderGL* shader, int batch) const;
+   void uploadPageTable();
+   void markPages(const ShaderGL* marking_shader, GLuint depth_texture, const CameraGL* camera);
+   void transferUniformsToShader(const ShaderGL* shader) const;
+   void resetStatistics();
+   [[nodiscard]] bool isEnabled() const { return Enabled; }
+   [[nodiscard]] int getLightIndex() const { return LightIndex; }
+   [[nodiscard]] int getPageBatchNum() const
+   {
+      return (static_cast<int>(RenderingPages.size()) + PagesPerBatch - 1) / PagesPerBatch;
+   }
+   [[nodiscard]] GLuint getFramebuffer() const { return FBO; }
+   [[nodiscard]] const glm::mat4& getViewProjectionMatrix() const { return ViewProjectionMatrix; }
+   [[nodiscard]] int getResidentPageNum() const;
+   [[nodiscard]] float getHitRate() const
+   {
+      return TotalRequestedPageNum > 0 ? static_cast<float>(TotalHitPageNum) / static_cast<float>(TotalRequestedPageNum) : 1.0f;
+   }
+   [[nodiscard]] float getRenderedPagesPerFrame() const
+   {
+      return FrameNum > 0 ? static_cast<float>(TotalRenderedPageNum) / static_cast<float>(FrameNum) : 0.0f;
+   }
+   [[nodiscard]] int getFrameNum() const { return FrameNum; }
+
+private:
+   // A batch of pages is rendered in one pass of the casters, one viewport per page, so it should not exceed
+   // the guaranteed number of viewports and the invocations of the page geometry shader.
+   inline static constexpr int PagesPerBatch = 16;
+   inline static constexpr int ThreadGroupSize = 16;
+   inline static constexpr int RequestWordNum = VirtualPageNum * VirtualPageNum / 32;
+
+   // The virtual map is fit to the scene in steps of this many world units, so that the cached pages survive
+   // the small changes of the scene bounds.
+   inline static constexpr float BoundsStep = 16.0f;
+
+   bool Enabled;
+   bool ReversedZ;
+   bool PageTableDirty;
+   bool HasNewRequests; // the requests were read back since the statistics last counted them
+   int PoolSize;
+   int MaxPagesPerFrame;
+   int LightIndex;
+   int FrameIndex;
+   int FrameNum;
+   long long TotalRequestedPageNum;
+   long long TotalHitPageNum;
+   long long TotalRenderedPageNum;
+   GLenum DepthFormat;
+   GLuint FBO;
+   GLuint PoolTextureID;
+   GLuint PageTableBuffer;
+   GLuint RequestBuffer;
+   GLuint ReadbackBuffer;
+   GLsync ReadbackFence;
+   glm::mat4 ViewProjectionMatrix;
+   std::vector<GLuint> PageTable; // the physical page of each virtual page, or UnmappedPage
+   std::vector<int> PhysicalPageOwners; // the virtual page of each physical page, or -1 if it is free
+   std::vector<int> LastRequestedFrames;
+   std::vector<int> RequestedPages; // the virtual pages which the visible receivers looked up when last read back
+   std::vector<int> RenderingPages; // the virtual pages mapped in this frame, which should be rendered
+   std::vector<glm::vec4> CasterSpheres; // the bounding spheres of the casters when their pages were last rendered
+
+   [[nodiscard]] int getPoolPageNum() const { return PoolSize / PageSize; }
+   [[nodiscard]] glm::ivec2 getPhysicalPageOffset(GLuint physical_page) const;
+   [[nodiscard]] glm::mat4 getPageViewProjection(int virtual_page) const;
+   [[nodiscard]] glm::mat4 getVirtualViewProjection(const glm::vec3& light_direction, const std::array<glm::vec3, 2>& scene_bounds) const;
+   void deletePool();
+   void unmapPage(int virtual_page);
+   void invalidatePages(const glm::vec4& bounding_sphere);
+   void invalidateAllPages();
+   void mapRequestedPages();
+};
\ No newline at end of file
@@ -1,9 +1,9 @@
 #version 460
 
-uniform mat4 WorldMatrix;
-uniform mat4 ViewMatrix;
-uniform mat4 ProjectionMatrix;
-uniform mat4 ModelViewProjectionMatrix;
+layout (location = 0) uniform mat4 WorldMatrix;
+layout (location = 1) uniform mat4 ViewMatrix;
+layout (location = 2) uniform mat4 ProjectionMatrix;
+layout (location = 3) uniform mat4 ModelViewProjectionMatrix;
 
 layout (location = 0) in vec3 v_position;
 layout (location = 1) in vec3 v_normal;
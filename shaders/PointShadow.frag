@@ -0,0 +1,22 @@
+#version 460
+
+#ifndef REVERSED_Z
+layout (constant_id = 2) const int REVERSED_Z = 0;
+#endif
+
+layout (location = 10) uniform vec3 LightPosition;
+layout (location = 11) uniform vec2 LightDepthRange;
+layout (location = 13) uniform vec2 DepthBias; // the slope-scaled bias and the constant bias in the normalized distance
+
+layout (location = 0) in vec3 position_in_wc;
+
+void main()
+{
+   // The depth is the linear distance from the light, so every cube face and hemisphere is compared the same way.
+   float distance = length( position_in_wc - LightPosition );
+   // The polygon offset does not apply to the written depth, so the same biases are added here.
+   float depth = (distance - LightDepthRange.x) / (LightDepthRange.y - LightDepthRange.x);
+   float slope = max( abs( dFdx( depth ) ), abs( dFdy( depth ) ) );
+   depth = clamp( depth + DepthBias.x * slope + DepthBias.y, 0.0f, 1.0f );
+   gl_FragDepth = REVERSED_Z != 0 ? 1.0f - depth : depth;
+}
\ No newline at end of file
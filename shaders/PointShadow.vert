@@ -0,0 +1,13 @@
+#version 460
+
+layout (location = 0) uniform mat4 WorldMatrix;
+
+layout (location = 0) in vec3 v_position;
+
+layout (location = 0) out vec3 position_in_wc;
+
+void main()
+{
+   position_in_wc = (WorldMatrix * vec4(v_position, 1.0f)).xyz;
+   gl_Position = vec4(position_in_wc, 1.0f);
+}
\ No newline at end of file
@@ -1,10 +1,22 @@
 #version 460
 
-#define MAX_LIGHTS 32
+// The shadow maps are filtered by PCF_KERNEL_SIZE x PCF_KERNEL_SIZE bilinear comparisons, which is 1, 3, 5, or 7.
+#ifndef PCF_KERNEL_SIZE
+layout (constant_id = 0) const int PCF_KERNEL_SIZE = 1;
+#endif
+
+// The spotlights are shadowed by the prefiltered moments instead of the depth comparison when it is not 0.
+#ifndef MOMENT_SHADOW
+layout (constant_id = 1) const int MOMENT_SHADOW = 0;
+#endif
+
+// The shadow maps store the reversed depth, 1 at the near plane and 0 at the far plane, when it is not 0.
+#ifndef REVERSED_Z
+layout (constant_id = 2) const int REVERSED_Z = 0;
+#endif
 
 struct LightInfo
 {
-   int LightSwitch;
    vec4 Position;
    vec4 AmbientColor;
    vec4 DiffuseColor;
@@ -13,8 +25,86 @@ struct LightInfo
    float SpotlightCutoffAngle;
    float SpotlightFeather;
    float FallOffRadius;
+   int LightSwitch;
+   float ShadowNormalOffset;
+};
+layout (std430, binding = 0) readonly buffer LightBuffer
+{
+   vec4 GlobalAmbient;
+   int UseLight;
+   int LightNum;
+   LightInfo Lights[];
+};
+
+layout (std430, binding = 1) readonly buffer ClusterBuffer
+{
+   uvec2 Clusters[];
+};
+
+layout (std430, binding = 2) readonly buffer ClusterLightIndexBuffer
+{
+   uint ClusterLightIndexNum;
+   uint ClusterLightIndices[];
+};
+
+layout (std430, binding = 3) readonly buffer ObjectLightIndexBuffer
+{
+   uint ObjectLightIndices[];
+};
+
+struct ShadowInfo
+{
+   mat4 ViewProjectionMatrix;
+   vec4 AtlasRect;
+   int HasShadow;
+   float TanHalfFov;
+   vec2 DepthRange;
+};
+
+layout (std430, binding = 4) readonly buffer ShadowBuffer
+{
+   ShadowInfo Shadows[];
+};
+
+struct PointShadowInfo
+{
+   vec4 Position;
+   vec2 DepthRange;
+   int Layer;
+   int Type;
+};
+
+layout (std430, binding = 5) readonly buffer PointShadowBuffer
+{
+   PointShadowInfo PointShadows[];
+};
+
+struct CascadeInfo
+{
+   mat4 ViewProjectionMatrices[4];
+   vec4 SplitDistances;
+   int FirstLayer;
+   int HasShadow;
+};
+
+layout (std430, binding = 6) readonly buffer CascadeBuffer
+{
+   CascadeInfo Cascades[];
+};
+
+// These should match VirtualShadowGL.
+const int VIRTUAL_PAGE_NUM = 128;
+const int VIRTUAL_PAGE_SIZE = 128;
+const uint UNMAPPED_PAGE = 0xFFFFFFFFu;
+
+// This should match ContactShadowGL.
+const int CONTACT_LIGHT_NUM = 4;
+
+// The physical page of each page of the virtual map, in the row-major order.
+layout (std430, binding = 7) readonly buffer PageTableBuffer
+{
+   uint PageTable[];
 };
-uniform LightInfo Lights[MAX_LIGHTS];
 
 struct MateralInfo {
    vec4 EmissionColor;
@@ -23,25 +113,48 @@ struct MateralInfo {
    vec4 SpecularColor;
    float SpecularExponent;
 };
-uniform MateralInfo Material;
+layout (location = 5) uniform MateralInfo Material;
 
 layout (binding = 0) uniform sampler2D BaseTexture;
-layout (binding = 1) uniform sampler2DShadow DepthMap;
-uniform int UseTexture;
+layout (binding = 1) uniform sampler2DShadow ShadowAtlas;
+layout (binding = 2) uniform samplerCubeArrayShadow PointShadowCubeMaps;
+layout (binding = 3) uniform sampler2DArrayShadow PointShadowParaboloids;
+layout (binding = 4) uniform sampler2DArrayShadow CascadedShadowMaps;
+layout (binding = 5) uniform sampler2D ShadowAtlasDepth; // the atlas without the comparison
+layout (binding = 6) uniform sampler2D MomentAtlas;
+layout (binding = 7) uniform sampler2DShadow VirtualShadowPool;
+layout (binding = 8) uniform sampler2D ContactShadowFactors; // at the half resolution
+layout (binding = 9) uniform sampler2D ContactShadowDepths;
+layout (location = 10) uniform int UseTexture;
 
-uniform int UseLight;
-uniform int LightIndex;
-uniform int LightNum;
-uniform vec4 GlobalAmbient;
+layout (location = 16) uniform int UseLightClusters;
+layout (location = 17) uniform uvec3 ClusterGridSize;
+layout (location = 18) uniform vec2 ClusterTileSize;
+layout (location = 19) uniform vec2 ClusterDepthSlice;
+layout (location = 20) uniform int ObjectLightIndexOffset;
+layout (location = 21) uniform int ObjectLightIndexNum;
+layout (location = 22) uniform float ShadowDepthEpsilon; // the depth step of the shadow map format, 0 for floats
+layout (location = 23) uniform int UseSoftShadows;
+layout (location = 24) uniform int BlockerSearchSampleNum;
+layout (location = 25) uniform int SoftShadowFilterSampleNum;
+layout (location = 26) uniform float LightSize; // the diameter of the area of the spotlights in the world space
+layout (location = 27) uniform float LightBleedingReduction;
+layout (location = 28) uniform int UseReceiverPlaneBias;
+layout (location = 29) uniform mat4 VirtualViewProjectionMatrix;
+layout (location = 30) uniform int VirtualShadowLight; // the light shadowed by the virtual map, or -1
+layout (location = 31) uniform int UseContactShadows;
+layout (location = 32) uniform int ReceiveShadows;
+layout (location = 33) uniform mat4 ContactReprojectionMatrix; // to the half resolution texels of the previous frame
 
-uniform mat4 ViewMatrix;
-uniform mat4 ProjectionMatrix;
+layout (location = 1) uniform mat4 ViewMatrix;
+layout (location = 2) uniform mat4 ProjectionMatrix;
 
-in vec3 position_in_ec;
-in vec3 normal_in_ec;
-in vec2 tex_coord;
+layout (location = 0) in vec3 position_in_ec;
+layout (location = 1) in vec3 normal_in_ec;
+layout (location = 2) in vec2 tex_coord;
 
-in vec4 depth_map_coord;
+layout (location = 3) in vec3 position_in_wc;
+layout (location = 4) in vec3 normal_in_wc;
 
 layout (location = 0) out vec4 final_color;
 
@@ -49,6 +162,25 @@ const float zero = 0.0f;
 const float one = 1.0f;
 const float half_pi = 1.57079632679489661923132169163975144f;
 
+// These should match LightGL::ShadowType.
+const int CUBE_MAP_SHADOW = 2;
+const int DUAL_PARABOLOID_SHADOW = 3;
+const int CASCADE_NUM = 4;
+
+// These should match MomentShadowGL::Type and ShadowMoments.comp.
+const int EXPONENTIAL_MOMENTS = 1;
+const int FOUR_MOMENTS = 2;
+const vec2 EXPONENTS = vec2(40.0f, 5.0f);
+
+// The inverse of the optimized quantization transform in ShadowMoments.comp.
+const mat4 MOMENT_DEQUANTIZATION = mat4(
+   0.2227744146f, 0.1549679261f, 0.1451988946f, 0.163127443f,
+   0.0771972861f, 0.1394629426f, 0.2120202157f, 0.2591432266f,
+   0.7926986636f, 0.7963415838f, 0.7258694464f, 0.6539092497f,
+   0.0319417555f, -0.1722823173f, -0.2758014811f, -0.3376131734f
+);
+const vec4 MOMENT_QUANTIZATION_OFFSET = vec4(0.035955884801f, 0.0f, 0.0f, 0.0f);
+
 bool IsPointLight(in vec4 light_position)
 {
    return light_position.w != zero;
@@ -68,8 +200,8 @@ float getSpotlightFactor(in vec3 normalized_light_vector, in int light_index)
 {
    if (Lights[light_index].SpotlightCutoffAngle >= 180.0f) return one;
 
-   vec4 direction_in_ec = transpose( inverse( ViewMatrix ) ) * vec4(Lights[light_index].SpotlightDirection, zero);
-   vec3 normalized_direction = normalize( direction_in_ec.xyz );
+   // As ViewMatrix is rigid body transformation, transpose( inverse( ViewMatrix ) ) is equal to ViewMatrix.
+   vec3 normalized_direction = normalize( mat3(ViewMatrix) * Lights[light_index].SpotlightDirection );
    float factor = dot( -normalized_light_vector, normalized_direction );
    float cutoff_angle = radians( clamp( Lights[light_index].SpotlightCutoffAngle, zero, 90.0f ) );
    if (factor >= cos( cutoff_angle )) {
@@ -81,55 +213,509 @@ float getSpotlightFactor(in vec3 normalized_light_vector, in int light_index)
    return zero;
 }
 
-float getShadowFactor()
+// The receiver is moved toward the light by the bias, which is toward the depth 1 for the reversed depth.
+float getBiasedReference(in float depth, in float bias)
+{
+   return REVERSED_Z != 0 ? depth + bias : depth - bias;
+}
+
+// The receiver is moved along its normal by the normal offset of the light in texels, further as the light
+// grazes it, so that its lookup leaves the depth slope of its own texel without biasing the depth itself.
+vec3 getNormalOffsetPosition(in int light_index, in vec3 normal, in float texel_size)
+{
+   vec4 light_position = Lights[light_index].Position;
+   vec3 light_direction = light_position.w == zero ?
+      normalize( light_position.xyz ) : normalize( light_position.xyz / light_position.w - position_in_wc );
+   float cosine = clamp( dot( normal, light_direction ), zero, one );
+   float sine = sqrt( one - cosine * cosine );
+   return position_in_wc + normal * (Lights[light_index].ShadowNormalOffset * texel_size * sine);
+}
+
+// The depth is already in [0, 1] for the zero-to-one clip control, so only the xy is remapped.
+vec3 getDepthMapCoord(in mat4 view_projection, in vec3 position)
+{
+   vec4 position_in_light_cc = view_projection * vec4(position, one);
+   vec3 depth_map_coord = position_in_light_cc.xyz / position_in_light_cc.w;
+   depth_map_coord.xy = 0.5f * depth_map_coord.xy + 0.5f;
+   return depth_map_coord;
+}
+
+// The receiver plane is spanned by two tangents of the normal, and their projections into the map give how its depth
+// changes across the map, so that every tap of a wide kernel is compared with the depth of the plane under the tap.
+// The gradient is dropped where the plane is seen edge-on, because it diverges there.
+vec2 getReceiverPlaneDepthGradient(in mat4 view_projection, in vec3 position, in vec3 normal, in vec3 coord, in float step)
 {
-   if (zero <= depth_map_coord.x && depth_map_coord.x <= depth_map_coord.w &&
-       zero <= depth_map_coord.y && depth_map_coord.y <= depth_map_coord.w &&
-       zero <= depth_map_coord.z && depth_map_coord.z <= depth_map_coord.w &&
-       zero < depth_map_coord.w) {
-      return textureProj( DepthMap, depth_map_coord );
+   vec3 tangent = normalize( cross( normal, abs( normal.y ) < 0.99f ? vec3(zero, one, zero) : vec3(one, zero, zero) ) );
+   vec3 bitangent = cross( normal, tangent );
+   vec3 a = getDepthMapCoord( view_projection, position + step * tangent ) - coord;
+   vec3 b = getDepthMapCoord( view_projection, position + step * bitangent ) - coord;
+   float determinant = a.x * b.y - a.y * b.x;
+   if (abs( determinant ) < 0.05f * length( a.xy ) * length( b.xy )) return vec2(zero);
+   return vec2(a.z * b.y - b.z * a.y, b.z * a.x - a.z * b.x) / determinant;
+}
+
+float getPointShadowFactor(in int light_index, in vec3 normal)
+{
+   PointShadowInfo shadow = PointShadows[light_index];
+   float texel_size = 2.0f * length( position_in_wc - shadow.Position.xyz ) / float(textureSize( PointShadowCubeMaps, 0 ).x);
+   vec3 light_vector = getNormalOffsetPosition( light_index, normal, texel_size ) - shadow.Position.xyz;
+   float distance = length( light_vector );
+
+   // The shadow maps store the linear distance from the light in the depth range.
+   const float bias_for_shadow_acne = max( 2e-4f, 2.0f * ShadowDepthEpsilon );
+   float depth = (distance - shadow.DepthRange.x) / (shadow.DepthRange.y - shadow.DepthRange.x);
+   if (depth - bias_for_shadow_acne >= one) return one;
+   float reference = getBiasedReference( REVERSED_Z != 0 ? one - depth : depth, bias_for_shadow_acne );
+
+   if (shadow.Type == CUBE_MAP_SHADOW) {
+      return texture( PointShadowCubeMaps, vec4(light_vector, float(shadow.Layer)), reference );
+   }
+
+   // The back hemisphere is the front one rotated by 180 degrees around the y-axis.
+   int hemisphere = 0;
+   if (light_vector.z < zero) {
+      light_vector.xz = -light_vector.xz;
+      hemisphere = 1;
    }
-   return 1.0f;
+   vec3 direction = light_vector / distance;
+   vec2 paraboloid_coord = 0.5f * direction.xy / (one + direction.z) + 0.5f;
+   return texture( PointShadowParaboloids, vec4(paraboloid_coord, float(2 * shadow.Layer + hemisphere), reference) );
 }
 
-vec4 calculateLightingEquation()
+// The bilinear comparisons of the kernel are one texel apart, so they cover PCF_KERNEL_SIZE + 1 texel columns.
+// The outer columns are weighted by the fraction of the sample position and the inner ones fully.
+float getPCFWeight(in int column, in float fraction)
 {
-   vec4 color = Material.EmissionColor + GlobalAmbient * Material.AmbientColor;
+   if (column == 0) return one - fraction;
+   if (column == PCF_KERNEL_SIZE) return fraction;
+   return one;
+}
+
+// The weights of the 2 x 2 texels in the order textureGather returns them.
+vec4 getGatherWeights(in ivec2 block, in vec2 fraction)
+{
+   float left = getPCFWeight( 2 * block.x, fraction.x );
+   float right = getPCFWeight( 2 * block.x + 1, fraction.x );
+   float bottom = getPCFWeight( 2 * block.y, fraction.y );
+   float top = getPCFWeight( 2 * block.y + 1, fraction.y );
+   return vec4(left * top, right * top, right * bottom, left * bottom);
+}
+
+// A gather compares 2 x 2 texels at once, so the kernel takes ((PCF_KERNEL_SIZE + 1) / 2)^2 fetches
+// instead of PCF_KERNEL_SIZE^2 bilinear taps. The gathers are kept inside the bounds, the tile of the atlas or the map.
+// The reference of each gather follows the receiver plane by the depth gradient, which is zero when it is off.
+float getAtlasPCF(in vec2 coord, in float reference, in vec2 depth_gradient, in vec2 lower_bound, in vec2 upper_bound)
+{
+   vec2 size = vec2(textureSize( ShadowAtlas, 0 ));
+   vec2 texel_coord = coord * size - 0.5f;
+   vec2 fraction = fract( texel_coord );
+   vec2 first = floor( texel_coord ) - float(PCF_KERNEL_SIZE / 2);
+   const int block_num = (PCF_KERNEL_SIZE + 1) / 2;
+   float sum = zero;
+   for (int y = 0; y < block_num; ++y) {
+      for (int x = 0; x < block_num; ++x) {
+         vec2 gather_coord = clamp( (first + vec2(2 * x + 1, 2 * y + 1)) / size, lower_bound, upper_bound );
+         float gather_reference = reference + dot( gather_coord - coord, depth_gradient );
+         sum += dot( textureGather( ShadowAtlas, gather_coord, gather_reference ), getGatherWeights( ivec2(x, y), fraction ) );
+      }
+   }
+   return sum / float(PCF_KERNEL_SIZE * PCF_KERNEL_SIZE);
+}
+
+float getCascadePCF(in vec2 coord, in float layer, in float reference, in vec2 depth_gradient)
+{
+   vec2 size = vec2(textureSize( CascadedShadowMaps, 0 ).xy);
+   vec2 texel_coord = coord * size - 0.5f;
+   vec2 fraction = fract( texel_coord );
+   vec2 first = floor( texel_coord ) - float(PCF_KERNEL_SIZE / 2);
+   const int block_num = (PCF_KERNEL_SIZE + 1) / 2;
+   float sum = zero;
+   for (int y = 0; y < block_num; ++y) {
+      for (int x = 0; x < block_num; ++x) {
+         vec2 gather_coord = clamp( (first + vec2(2 * x + 1, 2 * y + 1)) / size, one / size, one - one / size );
+         float gather_reference = reference + dot( gather_coord - coord, depth_gradient );
+         sum += dot(
+            textureGather( CascadedShadowMaps, vec3(gather_coord, layer), gather_reference ),
+            getGatherWeights( ivec2(x, y), fraction )
+         );
+      }
+   }
+   return sum / float(PCF_KERNEL_SIZE * PCF_KERNEL_SIZE);
+}
+
+// The texel size at the receiver is measured by projecting a unit step across the directional light,
+// which holds for the warped cascades as well as for the orthographic maps.
+float getDirectionalTexelSize(in int light_index, in mat4 view_projection, in float map_size)
+{
+   vec3 light_direction = normalize( Lights[light_index].Position.xyz );
+   vec3 across = normalize( cross( light_direction, abs( light_direction.y ) < 0.99f ? vec3(zero, one, zero) : vec3(one, zero, zero) ) );
+   vec2 step_in_map = getDepthMapCoord( view_projection, position_in_wc + across ).xy - getDepthMapCoord( view_projection, position_in_wc ).xy;
+   return one / max( length( step_in_map ) * map_size, 1e-4f );
+}
+
+float getCascadeShadowFactor(in int light_index, in int cascade, in vec3 normal)
+{
+   mat4 view_projection = Cascades[light_index].ViewProjectionMatrices[cascade];
+   float texel_size = getDirectionalTexelSize( light_index, view_projection, float(textureSize( CascadedShadowMaps, 0 ).x) );
+   vec3 position = getNormalOffsetPosition( light_index, normal, texel_size );
+   vec3 depth_map_coord = getDepthMapCoord( view_projection, position );
+   if (any( lessThan( depth_map_coord.xy, vec2(zero) ) ) || any( greaterThan( depth_map_coord.xy, vec2(one) ) )) return one;
+
+   const float bias_for_shadow_acne = max( 5e-4f, 2.0f * ShadowDepthEpsilon );
+   float layer = float(Cascades[light_index].FirstLayer + cascade);
+   float reference = getBiasedReference( depth_map_coord.z, bias_for_shadow_acne );
+   if (PCF_KERNEL_SIZE > 1) {
+      vec2 depth_gradient = UseReceiverPlaneBias != 0 ?
+         getReceiverPlaneDepthGradient( view_projection, position, normal, depth_map_coord, texel_size ) : vec2(zero);
+      return getCascadePCF( depth_map_coord.xy, layer, reference, depth_gradient );
+   }
+   return texture( CascadedShadowMaps, vec4(depth_map_coord.xy, layer, reference) );
+}
+
+float getCascadedShadowFactor(in int light_index, in vec3 normal)
+{
+   float depth = -position_in_ec.z;
+   vec4 splits = Cascades[light_index].SplitDistances;
+   int cascade = 0;
+   while (cascade < CASCADE_NUM && depth > splits[cascade]) ++cascade;
+   if (cascade == CASCADE_NUM) return one;
+
+   // The last part of a cascade fades into the next one, so that the change of the resolution is not visible.
+   const float blend_ratio = 0.1f;
+   float factor = getCascadeShadowFactor( light_index, cascade, normal );
+   float begin = cascade == 0 ? zero : splits[cascade - 1];
+   float blend_width = blend_ratio * (splits[cascade] - begin);
+   float blend = (depth - splits[cascade] + blend_width) / blend_width;
+   if (blend > zero && cascade + 1 < CASCADE_NUM) {
+      factor = mix( factor, getCascadeShadowFactor( light_index, cascade + 1, normal ), blend );
+   }
+   return factor;
+}
+
+// The virtual map is looked up through the page table, and a negative factor tells that the page is not resident,
+// so that the cascades shade the receiver until the page is rendered. The coordinates are kept half a texel
+// inside the physical page so that the filtering does not read the neighbor pages.
+float getVirtualShadowFactor(in int light_index, in vec3 normal)
+{
+   float texel_size = getDirectionalTexelSize( light_index, VirtualViewProjectionMatrix, float(VIRTUAL_PAGE_NUM * VIRTUAL_PAGE_SIZE) );
+   vec3 depth_map_coord = getDepthMapCoord( VirtualViewProjectionMatrix, getNormalOffsetPosition( light_index, normal, texel_size ) );
+   if (any( lessThan( depth_map_coord.xy, vec2(zero) ) ) || any( greaterThanEqual( depth_map_coord.xy, vec2(one) ) )) return -one;
+
+   vec2 page_coord = depth_map_coord.xy * float(VIRTUAL_PAGE_NUM);
+   ivec2 page = ivec2(page_coord);
+   uint physical_page = PageTable[page.y * VIRTUAL_PAGE_NUM + page.x];
+   if (physical_page == UNMAPPED_PAGE) return -one;
+
+   vec2 pool_size = vec2(textureSize( VirtualShadowPool, 0 ));
+   uint pool_page_num = uint(pool_size.x) / uint(VIRTUAL_PAGE_SIZE);
+   vec2 page_offset = float(VIRTUAL_PAGE_SIZE) * vec2(physical_page % pool_page_num, physical_page / pool_page_num);
+   vec2 texel_in_page = clamp( (page_coord - vec2(page)) * float(VIRTUAL_PAGE_SIZE), vec2(0.5f), vec2(float(VIRTUAL_PAGE_SIZE) - 0.5f) );
+   const float bias_for_shadow_acne = max( 1e-4f, 2.0f * ShadowDepthEpsilon );
+   float reference = getBiasedReference( depth_map_coord.z, bias_for_shadow_acne );
+   return texture( VirtualShadowPool, vec3((page_offset + texel_in_page) / pool_size, reference) );
+}
+
+// The samples of a Vogel disk spread evenly over the unit disk for any count, and the disk is rotated
+// per pixel so that the undersampling turns into noise rather than banding.
+vec2 getVogelDiskSample(in int index, in int sample_num, in float rotation)
+{
+   const float golden_angle = 2.39996322972865332f;
+   float radius = sqrt( (float(index) + 0.5f) / float(sample_num) );
+   float theta = float(index) * golden_angle + rotation;
+   return radius * vec2(cos( theta ), sin( theta ));
+}
+
+float getLinearDepth(in float depth, in vec2 depth_range)
+{
+   if (REVERSED_Z != 0) return depth_range.x * depth_range.y / (depth_range.x + depth * (depth_range.y - depth_range.x));
+   return depth_range.x * depth_range.y / (depth_range.y - depth * (depth_range.y - depth_range.x));
+}
+
+// The blockers are searched in the region of the map the light area can see through, and the penumbra is
+// estimated from their average depth by similar triangles. The filter is skipped when every sample of
+// the search agrees, because the fragment is then fully lit or fully shadowed.
+float getSoftShadowFactor(in int light_index, in vec2 coord, in float reference, in float receiver_depth)
+{
+   ShadowInfo shadow = Shadows[light_index];
+   vec2 lower_bound = shadow.AtlasRect.xy + 0.5f / vec2(textureSize( ShadowAtlas, 0 ));
+   vec2 upper_bound = shadow.AtlasRect.xy + shadow.AtlasRect.zw - 0.5f / vec2(textureSize( ShadowAtlas, 0 ));
+   float near_plane = shadow.DepthRange.x;
+   float light_size_in_map = LightSize / (2.0f * near_plane * shadow.TanHalfFov);
+   float rotation = 6.28318530718f * fract( 52.9829189f * fract( dot( gl_FragCoord.xy, vec2(0.06711056f, 0.00583715f) ) ) );
+
+   float search_radius = 0.5f * light_size_in_map * (receiver_depth - near_plane) / receiver_depth;
+   float blocker_depth_sum = zero;
+   int blocker_num = 0;
+   for (int i = 0; i < BlockerSearchSampleNum; ++i) {
+      vec2 offset = search_radius * getVogelDiskSample( i, BlockerSearchSampleNum, rotation );
+      vec2 sample_coord = clamp( shadow.AtlasRect.xy + (coord + offset) * shadow.AtlasRect.zw, lower_bound, upper_bound );
+      float depth = texture( ShadowAtlasDepth, sample_coord ).r;
+      if (REVERSED_Z != 0 ? depth > reference : depth < reference) {
+         blocker_depth_sum += getLinearDepth( depth, shadow.DepthRange );
+         ++blocker_num;
+      }
+   }
+   if (blocker_num == 0) return one;
+   if (blocker_num == BlockerSearchSampleNum) return zero;
+
+   float blocker_depth = blocker_depth_sum / float(blocker_num);
+   float filter_radius = 0.5f * light_size_in_map * (receiver_depth - blocker_depth) / blocker_depth * near_plane / receiver_depth;
+   float factor = zero;
+   for (int i = 0; i < SoftShadowFilterSampleNum; ++i) {
+      vec2 offset = filter_radius * getVogelDiskSample( i, SoftShadowFilterSampleNum, rotation );
+      vec2 sample_coord = clamp( shadow.AtlasRect.xy + (coord + offset) * shadow.AtlasRect.zw, lower_bound, upper_bound );
+      factor += texture( ShadowAtlas, vec3(sample_coord, reference) );
+   }
+   return factor / float(SoftShadowFilterSampleNum);
+}
+
+// The light bleeding reduction cuts off the tail of the lit probability, where the moments overestimate it.
+float reduceLightBleeding(in float factor)
+{
+   return clamp( (factor - LightBleedingReduction) / (one - LightBleedingReduction), zero, one );
+}
+
+// The upper bound of the probability that the receiver is lit, which is cut by the light bleeding reduction.
+float getChebyshevUpperBound(in vec2 moments, in float mean, in float min_variance)
+{
+   if (mean <= moments.x) return one;
+
+   float variance = max( moments.y - moments.x * moments.x, min_variance );
+   float difference = mean - moments.x;
+   return reduceLightBleeding( variance / (variance + difference * difference) );
+}
+
+// The Hamburger 4-moment reconstruction finds the distribution of 3 depths which matches the moments and
+// shadows the receiver the least, so it bounds the shadow much tighter than the Chebyshev inequality.
+float getFourMomentShadowFactor(in vec4 quantized_moments, in float depth)
+{
+   const float moment_bias = 3e-5f;
+   const float depth_bias = 1e-4f;
+   vec4 b = mix( MOMENT_DEQUANTIZATION * (quantized_moments - MOMENT_QUANTIZATION_OFFSET), vec4(0.5f), moment_bias );
+   vec3 z = vec3(depth - depth_bias, zero, zero);
+
+   // The Hankel matrix of the moments is factorized by Cholesky, keeping only its nontrivial entries.
+   float l32_d22 = -b.x * b.y + b.z;
+   float d22 = -b.x * b.x + b.y;
+   float squared_depth_variance = -b.y * b.y + b.w;
+   float d33_d22 = dot( vec2(squared_depth_variance, -l32_d22), vec2(d22, l32_d22) );
+   float inverse_d22 = one / d22;
+   float l32 = l32_d22 * inverse_d22;
+
+   vec3 c = vec3(one, z.x, z.x * z.x);
+   c.y -= b.x;
+   c.z -= b.y + l32 * c.y;
+   c.y *= inverse_d22;
+   c.z *= d22 / d33_d22;
+   c.y -= l32 * c.z;
+   c.x -= dot( c.yz, b.xy );
+
+   // The roots of c.x + c.y * z + c.z * z^2 are the other two depths of the distribution.
+   float p = c.y / c.z;
+   float q = c.x / c.z;
+   float r = sqrt( max( p * p * 0.25f - q, zero ) );
+   z.y = -p * 0.5f - r;
+   z.z = -p * 0.5f + r;
+
+   vec4 weights = z.z < z.x ? vec4(z.y, z.x, one, one) : (z.y < z.x ? vec4(z.x, z.y, zero, one) : vec4(zero));
+   float quotient = (weights.x * z.z - b.x * (weights.x + z.z) + b.y) / ((z.z - weights.y) * (z.x - z.y));
+   return reduceLightBleeding( one - clamp( weights.z + weights.w * quotient, zero, one ) );
+}
+
+// One trilinear fetch of the moments filters the shadow, because they were blurred and mipmapped when the tile was updated.
+// The lights are looped per fragment, where the implicit derivatives are undefined, so the screen derivatives
+// of the position are taken once in main and the moment lookups project them into the atlas themselves.
+vec3 position_dx_in_wc = vec3(0.0f);
+vec3 position_dy_in_wc = vec3(0.0f);
+
+float getMomentShadowFactor(in int light_index, in vec2 coord, in float receiver_depth)
+{
+   ShadowInfo shadow = Shadows[light_index];
+   vec2 half_texel = 0.5f / vec2(textureSize( MomentAtlas, 0 ));
+   vec2 atlas_coord = clamp(
+      shadow.AtlasRect.xy + coord * shadow.AtlasRect.zw,
+      shadow.AtlasRect.xy + half_texel, shadow.AtlasRect.xy + shadow.AtlasRect.zw - half_texel
+   );
+   mat4 view_projection = shadow.ViewProjectionMatrix;
+   vec2 center = getDepthMapCoord( view_projection, position_in_wc ).xy;
+   vec2 coord_dx = (getDepthMapCoord( view_projection, position_in_wc + position_dx_in_wc ).xy - center) * shadow.AtlasRect.zw;
+   vec2 coord_dy = (getDepthMapCoord( view_projection, position_in_wc + position_dy_in_wc ).xy - center) * shadow.AtlasRect.zw;
+   vec4 moments = textureGrad( MomentAtlas, atlas_coord, coord_dx, coord_dy );
+   float depth = (receiver_depth - shadow.DepthRange.x) / (shadow.DepthRange.y - shadow.DepthRange.x);
+   if (MOMENT_SHADOW == FOUR_MOMENTS) return getFourMomentShadowFactor( moments, depth );
+
+   float warped_depth = 2.0f * depth - one;
+   vec2 warped = vec2(exp( EXPONENTS.x * warped_depth ), -exp( -EXPONENTS.y * warped_depth ));
+   vec2 min_variance = 1e-4f * EXPONENTS * warped;
+   min_variance *= min_variance;
+   return min(
+      getChebyshevUpperBound( moments.xy, warped.x, min_variance.x ),
+      getChebyshevUpperBound( moments.zw, warped.y, min_variance.y )
+   );
+}
+
+float getShadowFactor(in int light_index)
+{
+   if (ReceiveShadows == 0) return one;
+
+   vec3 normal = normalize( normal_in_wc );
+   if (Cascades[light_index].HasShadow != 0) {
+      if (light_index == VirtualShadowLight) {
+         float factor = getVirtualShadowFactor( light_index, normal );
+         if (factor >= zero) return factor;
+      }
+      return getCascadedShadowFactor( light_index, normal );
+   }
+   if (PointShadows[light_index].Type == CUBE_MAP_SHADOW || PointShadows[light_index].Type == DUAL_PARABOLOID_SHADOW) {
+      return getPointShadowFactor( light_index, normal );
+   }
+   if (Shadows[light_index].HasShadow == 0) return one;
+
+   // The texel of the tile spans this much in the world space at the depth of the receiver.
+   mat4 view_projection = Shadows[light_index].ViewProjectionMatrix;
+   vec4 rect = Shadows[light_index].AtlasRect;
+   vec4 position_in_light_cc = view_projection * vec4(position_in_wc, one);
+   if (position_in_light_cc.w <= zero) return one;
+   float texel_size = 2.0f * position_in_light_cc.w * Shadows[light_index].TanHalfFov /
+      (rect.w * float(textureSize( ShadowAtlas, 0 ).y));
+   vec3 position = getNormalOffsetPosition( light_index, normal, texel_size );
+   position_in_light_cc = view_projection * vec4(position, one);
+   if (position_in_light_cc.w <= zero) return one;
+
+   const float bias_for_shadow_acne = max( 5e-7f, 2.0f * ShadowDepthEpsilon );
+   vec3 depth_map_coord = getDepthMapCoord( view_projection, position );
+   if (any( lessThan( depth_map_coord, vec3(zero) ) ) || any( greaterThan( depth_map_coord, vec3(one) ) )) return one;
+
+   if (MOMENT_SHADOW != 0) return getMomentShadowFactor( light_index, depth_map_coord.xy, position_in_light_cc.w );
+
+   float reference = getBiasedReference( depth_map_coord.z, bias_for_shadow_acne );
+   if (UseSoftShadows != 0) return getSoftShadowFactor( light_index, depth_map_coord.xy, reference, position_in_light_cc.w );
+
+   vec2 atlas_coord = rect.xy + depth_map_coord.xy * rect.zw;
+   vec2 texel = one / vec2(textureSize( ShadowAtlas, 0 ));
+   if (PCF_KERNEL_SIZE > 1) {
+      // The gradient over the tile is scaled to the gradient over the atlas.
+      vec2 depth_gradient = UseReceiverPlaneBias != 0 ?
+         getReceiverPlaneDepthGradient( view_projection, position, normal, depth_map_coord, texel_size ) / rect.zw : vec2(zero);
+      return getAtlasPCF( atlas_coord, reference, depth_gradient, rect.xy + texel, rect.xy + rect.zw - texel );
+   }
+
+   // The coordinates are kept half a texel inside the tile so that the filtering does not read the neighbor tiles.
+   atlas_coord = clamp( atlas_coord, rect.xy + 0.5f * texel, rect.xy + rect.zw - 0.5f * texel );
+   return texture( ShadowAtlas, vec3(atlas_coord, reference) );
+}
+
+// The factors were marched over the depth of the previous frame, so the pixel is reprojected into that view first.
+// The half resolution factors are upsampled with the bilinear weights of the 4 nearest texels, which are scaled down
+// where their depth differs from this pixel, so that the contact shadows do not bleed across the silhouettes.
+vec4 getContactShadowFactors()
+{
+   vec4 reprojected = ContactReprojectionMatrix * vec4(position_in_wc, one);
+   if (reprojected.w <= zero) return vec4(one);
+
+   vec2 texel_coord = reprojected.xy / reprojected.w;
+   ivec2 last = textureSize( ContactShadowFactors, 0 ) - 1;
+   if (any( lessThan( texel_coord, vec2(-0.5f) ) ) || any( greaterThan( texel_coord, vec2(last) + 0.5f ) )) return vec4(one);
+
+   ivec2 base = ivec2(floor( texel_coord ));
+   vec2 fraction = texel_coord - vec2(base);
+   float depth = reprojected.w;
+   vec4 sum = vec4(zero);
+   float weight_sum = zero;
+   float closest_difference = 1e+30f;
+   for (int i = 0; i < 4; ++i) {
+      ivec2 offset = ivec2(i & 1, i >> 1);
+      ivec2 texel = clamp( base + offset, ivec2(0), last );
+      vec2 bilinear = mix( one - fraction, fraction, vec2(offset) );
+      float depth_difference = abs( texelFetch( ContactShadowDepths, texel, 0 ).r - depth ) / depth;
+      float weight = bilinear.x * bilinear.y / (1e-3f + depth_difference);
+      sum += weight * texelFetch( ContactShadowFactors, texel, 0 );
+      weight_sum += weight;
+      closest_difference = min( closest_difference, depth_difference );
+   }
+
+   // The pixel was hidden in the previous frame if no texel is near its depth, so it is left without the contact shadow.
+   if (closest_difference > 0.05f) return vec4(one);
+   return weight_sum > zero ? sum / weight_sum : vec4(one);
+}
+
+// The factors are upsampled once per pixel, before the lights are accumulated.
+vec4 contact_shadow_factors = vec4(1.0f);
+
+vec4 calculateLocalColor(in int light_index, in vec3 view_vector)
+{
+   if (Lights[light_index].LightSwitch == 0) return vec4(zero);
+
+   vec4 light_position_in_ec = ViewMatrix * Lights[light_index].Position;
 
-   if (Lights[LightIndex].LightSwitch == 0) return color;
-      
-   vec4 light_position_in_ec = ViewMatrix * Lights[LightIndex].Position;
-      
    float final_effect_factor = one;
    vec3 light_vector = light_position_in_ec.xyz - position_in_ec;
    if (IsPointLight( light_position_in_ec )) {
-      float attenuation = getAttenuation( light_vector, LightIndex );
+      float attenuation = getAttenuation( light_vector, light_index );
 
       light_vector = normalize( light_vector );
-      float spotlight_factor = getSpotlightFactor( light_vector, LightIndex );
+      float spotlight_factor = getSpotlightFactor( light_vector, light_index );
       final_effect_factor = attenuation * spotlight_factor;
    }
    else light_vector = normalize( light_position_in_ec.xyz );
-   
-   if (final_effect_factor <= zero) return color;
 
-   vec4 local_color = Lights[LightIndex].AmbientColor * Material.AmbientColor;
+   if (final_effect_factor <= zero) return vec4(zero);
+
+   vec4 local_color = Lights[light_index].AmbientColor * Material.AmbientColor;
 
    float diffuse_intensity = max( dot( normal_in_ec, light_vector ), zero );
-   local_color += diffuse_intensity * Lights[LightIndex].DiffuseColor * Material.DiffuseColor;
+   local_color += diffuse_intensity * Lights[light_index].DiffuseColor * Material.DiffuseColor;
 
-   vec3 halfway_vector = normalize( light_vector - normalize( position_in_ec ) );
+   vec3 halfway_vector = normalize( light_vector + view_vector );
    float specular_intensity = max( dot( normal_in_ec, halfway_vector ), zero );
-   local_color += 
-      pow( specular_intensity, Material.SpecularExponent ) * 
-      Lights[LightIndex].SpecularColor * Material.SpecularColor;
+   local_color +=
+      pow( specular_intensity, Material.SpecularExponent ) *
+      Lights[light_index].SpecularColor * Material.SpecularColor;
+
+   // The shadow of every light is looked up in this pass, so the scene is drawn to the main view only once.
+   // The contact shadow only adds the detail which is too small for the shadow map, so they are not multiplied.
+   float shadow_factor = getShadowFactor( light_index );
+   if (UseContactShadows != 0 && ReceiveShadows != 0 && light_index < CONTACT_LIGHT_NUM) {
+      shadow_factor = min( shadow_factor, contact_shadow_factors[light_index] );
+   }
+   final_effect_factor *= shadow_factor;
+   return local_color * final_effect_factor;
+}
 
-   color += local_color * final_effect_factor * getShadowFactor();
+uint getClusterIndex()
+{
+   uvec3 cluster;
+   cluster.xy = min( uvec2(gl_FragCoord.xy / ClusterTileSize), ClusterGridSize.xy - 1u );
+   float slice = log( max( -position_in_ec.z, 1e-5f ) ) * ClusterDepthSlice.x + ClusterDepthSlice.y;
+   cluster.z = uint(clamp( slice, zero, float(ClusterGridSize.z - 1u) ));
+   return cluster.x + ClusterGridSize.x * (cluster.y + ClusterGridSize.y * cluster.z);
+}
+
+vec4 calculateLightingEquation()
+{
+   vec4 color = Material.EmissionColor + GlobalAmbient * Material.AmbientColor;
+   vec3 view_vector = -normalize( position_in_ec );
+   if (UseContactShadows != 0) contact_shadow_factors = getContactShadowFactors();
+
+   if (UseLightClusters != 0) {
+      uvec2 cluster = Clusters[getClusterIndex()];
+      for (uint i = 0u; i < cluster.y; ++i) {
+         color += calculateLocalColor( int(ClusterLightIndices[cluster.x + i]), view_vector );
+      }
+   }
+   else {
+      for (int i = 0; i < ObjectLightIndexNum; ++i) {
+         color += calculateLocalColor( int(ObjectLightIndices[ObjectLightIndexOffset + i]), view_vector );
+      }
+   }
    return color;
 }
 
 void main()
 { 
+   position_dx_in_wc = dFdx( position_in_wc );
+   position_dy_in_wc = dFdy( position_in_wc );
+
    if (UseTexture == 0) final_color = vec4(one);
    else final_color = texture( BaseTexture, tex_coord );
 
@@ -17,7 +17,7 @@ CameraGL::CameraGL(
    float near_plane,
    float far_plane
 ) : 
-   IsMoving( false ), Width( 0 ), Height( 0 ), FOV( fov ), InitFOV( fov ), NearPlane( near_plane ), FarPlane( far_plane ),
+   IsMoving( false ), ReversedZ( false ), Width( 0 ), Height( 0 ), FOV( fov ), InitFOV( fov ), NearPlane( near_plane ), FarPlane( far_plane ),
    AspectRatio( 0.0f ), ZoomSensitivity( 1.0f ), MoveSensitivity( 0.05f ), RotationSensitivity( 0.005f ),  
    InitCamPos( cam_position ), InitRefPos( view_reference_position ), InitUpVec( view_up_vector ), CamPos( cam_position ),
    ViewMatrix( lookAt( InitCamPos, InitRefPos, InitUpVec ) ), ProjectionMatrix(glm::mat4(1.0f) )
@@ -99,7 +99,7 @@ void CameraGL::zoomIn()
 {
    if (FOV > 0.0f) {
       FOV -= ZoomSensitivity;
-      ProjectionMatrix = glm::perspective( glm::radians( FOV ), AspectRatio, NearPlane, FarPlane );
+      updateProjectionMatrix();
    }
 }
 
@@ -107,7 +107,7 @@ void CameraGL::zoomOut()
 {
    if (FOV < 90.0f) {
       FOV += ZoomSensitivity;
-      ProjectionMatrix = glm::perspective( glm::radians( FOV ), AspectRatio, NearPlane, FarPlane );
+      updateProjectionMatrix();
    }
 }
 
@@ -115,7 +115,46 @@ void CameraGL::resetCamera()
 {
    CamPos = InitCamPos; 
    ViewMatrix = lookAt( InitCamPos, InitRefPos, InitUpVec );
-   ProjectionMatrix = glm::perspective( glm::radians( InitFOV ), AspectRatio, NearPlane, FarPlane );
+   ProjectionMatrix = getPerspectiveProjection( glm::radians( InitFOV ), AspectRatio, NearPlane, FarPlane, ReversedZ );
+}
+
+void CameraGL::setReversedZ(bool reversed_z)
+{
+   ReversedZ = reversed_z;
+   updateProjectionMatrix();
+}
+
+glm::mat4 CameraGL::getPerspectiveProjection(
+   float fov_in_radians,
+   float aspect_ratio,
+   float near_plane,
+   float far_plane,
+   bool reversed_z
+)
+{
+   // The depth is mapped to [0, 1] for the zero-to-one clip control. The reversed depth swaps the planes,
+   // so the float precision, which is densest around 0, balances the hyperbolic distribution of the depth.
+   if (reversed_z) return glm::perspectiveRH_ZO( fov_in_radians, aspect_ratio, far_plane, near_plane );
+   return glm::perspectiveRH_ZO( fov_in_radians, aspect_ratio, near_plane, far_plane );
+}
+
+glm::mat4 CameraGL::getOrthographicProjection(
+   float left,
+   float right,
+   float bottom,
+   float top,
+   float near_plane,
+   float far_plane,
+   bool reversed_z
+)
+{
+   if (reversed_z) return glm::orthoRH_ZO( left, right, bottom, top, far_plane, near_plane );
+   return glm::orthoRH_ZO( left, right, bottom, top, near_plane, far_plane );
+}
+
+void CameraGL::updateProjectionMatrix()
+{
+   ProjectionMatrix = getPerspectiveProjection( glm::radians( FOV ), AspectRatio, NearPlane, FarPlane, ReversedZ );
 }
 
 void CameraGL::updateWindowSize(int width, int height)
@@ -123,7 +162,45 @@ void CameraGL::updateWindowSize(int width, int height)
    Width = width;
    Height = height;
    AspectRatio = static_cast<float>(width) / static_cast<float>(height);
-   ProjectionMatrix = glm::perspective( glm::radians( FOV ), AspectRatio, NearPlane, FarPlane );
+   updateProjectionMatrix();
+}
+
+void CameraGL::updateProjection(float fov, float aspect_ratio, float near_plane, float far_plane)
+{
+   FOV = fov;
+   AspectRatio = aspect_ratio;
+   NearPlane = near_plane;
+   FarPlane = far_plane;
+   updateProjectionMatrix();
+}
+
+std::array<glm::vec3, 8> CameraGL::getFrustumSliceCorners(float near_distance, float far_distance) const
+{
+   // The first 4 corners are on the near side of the slice and the others on the far side, in the world space.
+   const float tangent_y = std::tan( glm::radians( FOV ) * 0.5f );
+   const float tangent_x = tangent_y * AspectRatio;
+   const glm::mat4 inverse_view = glm::inverse( ViewMatrix );
+   std::array<glm::vec3, 8> corners{};
+   for (int i = 0; i < 8; ++i) {
+      const float distance = i < 4 ? near_distance : far_distance;
+      const float x = (i & 1) != 0 ? tangent_x : -tangent_x;
+      const float y = (i & 2) != 0 ? tangent_y : -tangent_y;
+      corners[i] = glm::vec3(inverse_view * glm::vec4(x * distance, y * distance, -distance, 1.0f));
+   }
+   return corners;
+}
+
+glm::vec4 CameraGL::getFrustumSliceBoundingSphere(float near_distance, float far_distance) const
+{
+   // The corners of the slice between the two distances are bounded in the world space.
+   const std::array<glm::vec3, 8> corners = getFrustumSliceCorners( near_distance, far_distance );
+
+   glm::vec3 center(0.0f);
+   for (const auto& corner : corners) center += corner;
+   center /= static_cast<float>(corners.size());
+   float radius = 0.0f;
+   for (const auto& corner : corners) radius = std::max( radius, glm::length( corner - center ) );
+   return { center, radius };
 }
 
 void CameraGL::updateCameraPosition(
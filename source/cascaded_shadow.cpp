@@ -0,0 +1,257 @@
+#include "cascaded_shadow.h"
+
+static_assert( sizeof( CascadedShadowGL::CascadeInfo ) == 288, "CascadeInfo should match the std430 layout" );
+
+CascadedShadowGL::CascadedShadowGL(int map_size, int max_light_num, float shadow_distance, GLenum depth_format) :
+   MapSize( map_size ), MaxLightNum( max_light_num ), CascadeCapacity( 0 ), ShadowDistance( shadow_distance ),
+   DepthFormat( depth_format ), ReversedZ( false ), UseWarping( false ), FBO( 0 ), DepthArrayID( 0 ), CascadeBuffer( 0 ),
+   SplitRangeSteps( std::numeric_limits<int>::max(), std::numeric_limits<int>::lowest() )
+{
+}
+
+CascadedShadowGL::~CascadedShadowGL()
+{
+   deleteShadowMaps();
+   if (CascadeBuffer != 0) glDeleteBuffers( 1, &CascadeBuffer );
+}
+
+void CascadedShadowGL::deleteShadowMaps()
+{
+   if (DepthArrayID != 0) glDeleteTextures( 1, &DepthArrayID );
+   if (FBO != 0) glDeleteFramebuffers( 1, &FBO );
+   DepthArrayID = FBO = 0;
+}
+
+void CascadedShadowGL::createShadowMaps()
+{
+   glCreateTextures( GL_TEXTURE_2D_ARRAY, 1, &DepthArrayID );
+   glTextureStorage3D( DepthArrayID, 1, DepthFormat, MapSize, MapSize, CascadeNum * MaxLightNum );
+   glTextureParameteri( DepthArrayID, GL_TEXTURE_MIN_FILTER, GL_LINEAR );
+   glTextureParameteri( DepthArrayID, GL_TEXTURE_MAG_FILTER, GL_LINEAR );
+   glTextureParameteri( DepthArrayID, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE );
+   glTextureParameteri( DepthArrayID, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE );
+   glTextureParameteri( DepthArrayID, GL_TEXTURE_COMPARE_MODE, GL_COMPARE_REF_TO_TEXTURE );
+   glTextureParameteri( DepthArrayID, GL_TEXTURE_COMPARE_FUNC, ReversedZ ? GL_GEQUAL : GL_LEQUAL );
+
+   // The whole array is attached, so the geometry shader chooses the cascade with gl_Layer.
+   glCreateFramebuffers( 1, &FBO );
+   glNamedFramebufferTexture( FBO, GL_DEPTH_ATTACHMENT, DepthArrayID, 0 );
+}
+
+void CascadedShadowGL::recreateShadowMaps(int map_size, GLenum depth_format, bool reversed_z)
+{
+   deleteShadowMaps();
+   MapSize = map_size;
+   DepthFormat = depth_format;
+   ReversedZ = reversed_z;
+   createShadowMaps();
+}
+
+std::array<float, CascadedShadowGL::CascadeNum> CascadedShadowGL::getSplitDistances(float near_plane, float far_plane) const
+{
+   // The practical split scheme blends the logarithmic split, which keeps the texel density even in depth,
+   // with the uniform split, which keeps the near cascades from being too thin.
+   std::array<float, CascadeNum> splits{};
+   for (int i = 0; i < CascadeNum; ++i) {
+      const float ratio = static_cast<float>(i + 1) / static_cast<float>(CascadeNum);
+      const float logarithmic_split = near_plane * std::pow( far_plane / near_plane, ratio );
+      const float uniform_split = near_plane + (far_plane - near_plane) * ratio;
+      splits[i] = glm::mix( uniform_split, logarithmic_split, SplitLambda );
+   }
+   return splits;
+}
+
+void CascadedShadowGL::updateSplitRange(const glm::vec2& visible_depth_range)
+{
+   // The visible range changes whenever anything in the view moves. If the splits followed it, the slices and
+   // their texel sizes would change every frame, and the shadow edges would shimmer in spite of the texel snapping.
+   // So the range is widened to whole steps, and it is only refit when the visible range leaves it
+   // or becomes more than one step narrower than it.
+   const float step = std::log( SplitRangeStep );
+   const auto near_step = static_cast<int>(std::floor( std::log( std::max( visible_depth_range.x, 1e-3f ) ) / step ));
+   const auto far_step = static_cast<int>(std::ceil( std::log( std::max( visible_depth_range.y, 1e-3f ) ) / step ));
+   const bool contains = SplitRangeSteps.x <= near_step && far_step <= SplitRangeSteps.y;
+   const bool fits = near_step - 1 <= SplitRangeSteps.x && SplitRangeSteps.y <= far_step + 1;
+   if (!contains || !fits) SplitRangeSteps = glm::ivec2(near_step, far_step);
+}
+
+glm::mat4 CascadedShadowGL::getCascadeViewProjection(
+   const glm::vec3& light_direction,
+   const glm::vec4& bounding_sphere,
+   const std::array<glm::vec3, 2>& scene_bounds
+) const
+{
+   // The cascade is fit to the bounding sphere of the frustum slice, so its size does not change
+   // when the camera rotates, and the sphere is quantized to keep the size exact from frame to frame.
+   const glm::vec3 center = glm::vec3(bounding_sphere);
+   const float radius = std::ceil( bounding_sphere.w * 16.0f ) / 16.0f;
+
+   // The light view never rotates with the camera and the center is snapped to the texel grid,
+   // so the shadow edges do not shimmer while the camera moves.
+   const glm::vec3 up = std::abs( light_direction.y ) > 0.99f ? glm::vec3(1.0f, 0.0f, 0.0f) : glm::vec3(0.0f, 1.0f, 0.0f);
+   const glm::mat4 light_view = lookAt( glm::vec3(0.0f), light_direction, up );
+   glm::vec3 center_in_light = glm::vec3(light_view * glm::vec4(center, 1.0f));
+   const float texel_size = 2.0f * radius / static_cast<float>(MapSize);
+   center_in_light.x = std::floor( center_in_light.x / texel_size ) * texel_size;
+   center_in_light.y = std::floor( center_in_light.y / texel_size ) * texel_size;
+
+   // The depth range of the cascade is trimmed to the scene, and the casters in front of the near plane
+   // are clamped onto it by the depth clamp of the cascade pass.
+   float scene_near = std::numeric_limits<float>::max(), scene_far = std::numeric_limits<float>::lowest();
+   for (int i = 0; i < 8; ++i) {
+      const glm::vec3 corner(scene_bounds[i & 1].x, scene_bounds[(i >> 1) & 1].y, scene_bounds[(i >> 2) & 1].z);
+      const float depth = -(light_view * glm::vec4(corner, 1.0f)).z;
+      scene_near = std::min( scene_near, depth );
+      scene_far = std::max( scene_far, depth );
+   }
+   const float near_plane = std::max( scene_near, -center_in_light.z - radius );
+   const float far_plane = std::max( std::min( scene_far, -center_in_light.z + radius ), near_plane + 1.0f );
+   const glm::mat4 projection = CameraGL::getOrthographicProjection(
+      center_in_light.x - radius, center_in_light.x + radius,
+      center_in_light.y - radius, center_in_light.y + radius,
+      near_plane, far_plane, ReversedZ
+   );
+   return projection * light_view;
+}
+
+glm::mat4 CascadedShadowGL::getWarpedCascadeViewProjection(
+   const glm::vec3& light_direction,
+   const CameraGL* camera,
+   float near_distance,
+   float far_distance,
+   const std::array<glm::vec3, 2>& scene_bounds
+) const
+{
+   // The light space perspective shadow map puts a perspective frustum, which looks along the view direction
+   // projected onto the shadow map plane, around the slice. The light rays stay parallel to its depth axis,
+   // so the near part of the slice gets more texels, like it does in the view.
+   const glm::vec3 view_direction = camera->getViewDirection();
+   const float cosine = glm::dot( view_direction, light_direction );
+   const float sine = std::sqrt( std::max( 1.0f - cosine * cosine, 0.0f ) );
+   if (sine < MinWarpSine) {
+      return getCascadeViewProjection(
+         light_direction, camera->getFrustumSliceBoundingSphere( near_distance, far_distance ), scene_bounds
+      );
+   }
+
+   // In the light space, the light looks along -z and the projected view direction is +y.
+   const glm::vec3 warp_axis = glm::normalize( view_direction - cosine * light_direction );
+   const glm::mat4 light_view = lookAt( glm::vec3(0.0f), light_direction, warp_axis );
+   const std::array<glm::vec3, 8> corners = camera->getFrustumSliceCorners( near_distance, far_distance );
+   glm::vec3 min_point(std::numeric_limits<float>::max()), max_point(std::numeric_limits<float>::lowest());
+   for (const auto& corner : corners) {
+      const glm::vec3 point = glm::vec3(light_view * glm::vec4(corner, 1.0f));
+      min_point = glm::min( min_point, point );
+      max_point = glm::max( max_point, point );
+   }
+
+   // The optimal distance of the projection center from the slice balances the aliasing along the slice,
+   // and it grows to infinity, the uniform map, as the view turns to the light.
+   const float slice_length = max_point.y - min_point.y;
+   const float z_near = near_distance;
+   const float z_far = z_near + slice_length * sine;
+   const float n = (z_near + std::sqrt( z_near * z_far )) / sine;
+   const float f = n + slice_length;
+   const glm::vec3 eye_in_light = glm::vec3(light_view * glm::vec4(camera->getCameraPosition(), 1.0f));
+   const glm::vec3 center(eye_in_light.x, min_point.y - n, eye_in_light.z);
+
+   // The perspective divides by y, so it maps [n, f] on the y-axis to [-1, 1] and leaves x and z to the division.
+   glm::mat4 perspective(1.0f);
+   perspective[1][1] = (f + n) / (f - n);
+   perspective[3][1] = -2.0f * f * n / (f - n);
+   perspective[1][3] = 1.0f;
+   perspective[3][3] = 0.0f;
+   const glm::mat4 warp = perspective * glm::translate( glm::mat4(1.0f), -center ) * light_view;
+
+   // The warped slice is fit into the map by an orthographic projection. The casters in front of it are clamped
+   // onto its near plane by the depth clamp of the cascade pass.
+   glm::vec3 warped_min(std::numeric_limits<float>::max()), warped_max(std::numeric_limits<float>::lowest());
+   for (const auto& corner : corners) {
+      const glm::vec4 point = warp * glm::vec4(corner, 1.0f);
+      const glm::vec3 warped = glm::vec3(point) / point.w;
+      warped_min = glm::min( warped_min, warped );
+      warped_max = glm::max( warped_max, warped );
+   }
+   const glm::mat4 fit = CameraGL::getOrthographicProjection(
+      warped_min.x, warped_max.x, warped_min.y, warped_max.y,
+      -warped_max.z, std::max( -warped_min.z, -warped_max.z + 1e-4f ), ReversedZ
+   );
+   return fit * warp;
+}
+
+void CascadedShadowGL::reserveCascadeBuffer()
+{
+   const auto light_num = static_cast<int>(Cascades.size());
+   if (CascadeBuffer != 0 && light_num <= CascadeCapacity) return;
+
+   CascadeCapacity = std::max( 8, CascadeCapacity );
+   while (CascadeCapacity < light_num) CascadeCapacity *= 2;
+   if (CascadeBuffer != 0) glDeleteBuffers( 1, &CascadeBuffer );
+
+   glCreateBuffers( 1, &CascadeBuffer );
+   glNamedBufferStorage(
+      CascadeBuffer,
+      static_cast<GLsizeiptr>(sizeof( CascadeInfo ) * CascadeCapacity),
+      nullptr,
+      GL_DYNAMIC_STORAGE_BIT
+   );
+}
+
+void CascadedShadowGL::updateCascades(
+   const LightGL* lights,
+   const CameraGL* camera,
+   const glm::vec2& visible_depth_range,
+   const std::array<glm::vec3, 2>& scene_bounds
+)
+{
+   const int light_num = lights->getTotalLightNum();
+   Cascades.assign( light_num, CascadeInfo{} );
+
+   // The cascades are split over the depths which are actually visible, not over the whole view frustum.
+   updateSplitRange( visible_depth_range );
+   const float near_plane = std::max( camera->getNearPlane(), std::pow( SplitRangeStep, static_cast<float>(SplitRangeSteps.x) ) );
+   const float far_plane = std::max(
+      std::min( { camera->getFarPlane(), ShadowDistance, std::pow( SplitRangeStep, static_cast<float>(SplitRangeSteps.y) ) } ),
+      near_plane + 1.0f
+   );
+   const std::array<float, CascadeNum> splits = getSplitDistances( near_plane, far_plane );
+
+   int cascaded_light_num = 0;
+   for (int i = 0; i < light_num && cascaded_light_num < MaxLightNum; ++i) {
+      if (lights->getShadowType( i ) != LightGL::ShadowType::Cascaded) continue;
+
+      CascadeInfo& cascade = Cascades[i];
+      const glm::vec3 light_direction = -glm::normalize( glm::vec3(lights->getLightPosition( i )) );
+      float begin = near_plane;
+      for (int c = 0; c < CascadeNum; ++c) {
+         cascade.ViewProjectionMatrices[c] = UseWarping ?
+            getWarpedCascadeViewProjection( light_direction, camera, begin, splits[c], scene_bounds ) :
+            getCascadeViewProjection( light_direction, camera->getFrustumSliceBoundingSphere( begin, splits[c] ), scene_bounds );
+         cascade.SplitDistances[c] = splits[c];
+         begin = splits[c];
+      }
+      cascade.FirstLayer = CascadeNum * cascaded_light_num++;
+      cascade.HasShadow = 1;
+   }
+
+   if (Cascades.empty()) return;
+   reserveCascadeBuffer();
+   glNamedBufferSubData( CascadeBuffer, 0, static_cast<GLsizeiptr>(sizeof( CascadeInfo ) * Cascades.size()), Cascades.data() );
+}
+
+void CascadedShadowGL::transferLightUniformsToShader(const ShaderGL* shader, int light_index) const
+{
+   const CascadeInfo& cascade = Cascades[light_index];
+   glUniformMatrix4fv(
+      shader->getUniformLocation( "CascadeViewProjectionMatrices" ), CascadeNum, GL_FALSE,
+      &cascade.ViewProjectionMatrices[0][0][0]
+   );
+   glUniform1i( shader->getUniformLocation( "LayerOffset" ), cascade.FirstLayer );
+}
+
+void CascadedShadowGL::transferUniformsToShader(const ShaderGL* shader) const
+{
+   const GLint binding = shader->getStorageBlockBinding( "CascadeBuffer" );
+   if (binding >= 0) glBindBufferBase( GL_SHADER_STORAGE_BUFFER, static_cast<GLuint>(binding), CascadeBuffer );
+   glBindTextureUnit( 4, DepthArrayID );
+}
\ No newline at end of file
@@ -0,0 +1,99 @@
+#include "contact_shadow.h"
+
+ContactShadowGL::ContactShadowGL(int step_num, float ray_length, float thickness) :
+   Enabled( false ), HasDepthView( false ), DepthReversedZ( false ), StepNum( step_num ), RayLength( ray_length ),
+   Thickness( thickness ), Width( 0 ), Height( 0 ), FactorTextureID( 0 ), DepthTextureID( 0 ), DepthViewMatrix( 1.0f ),
+   DepthProjectionMatrix( 1.0f ), ReprojectionMatrix( 1.0f )
+{
+}
+
+ContactShadowGL::~ContactShadowGL()
+{
+   deleteTextures();
+}
+
+void ContactShadowGL::deleteTextures()
+{
+   if (FactorTextureID != 0) glDeleteTextures( 1, &FactorTextureID );
+   if (DepthTextureID != 0) glDeleteTextures( 1, &DepthTextureID );
+   FactorTextureID = DepthTextureID = 0;
+}
+
+void ContactShadowGL::resize(int width, int height)
+{
+   // The rays are marched at the half resolution, because the contact shadows are small and soft anyway.
+   const int half_width = std::max( (width + 1) / 2, 1 );
+   const int half_height = std::max( (height + 1) / 2, 1 );
+   if (half_width == Width && half_height == Height && FactorTextureID != 0) return;
+
+   // The main target is resized at the same time, so the depth of the previous frame is lost.
+   deleteTextures();
+   HasDepthView = false;
+   Width = half_width;
+   Height = half_height;
+   glCreateTextures( GL_TEXTURE_2D, 1, &FactorTextureID );
+   glTextureStorage2D( FactorTextureID, 1, GL_RGBA8, Width, Height );
+   glTextureParameteri( FactorTextureID, GL_TEXTURE_MIN_FILTER, GL_NEAREST );
+   glTextureParameteri( FactorTextureID, GL_TEXTURE_MAG_FILTER, GL_NEAREST );
+   glCreateTextures( GL_TEXTURE_2D, 1, &DepthTextureID );
+   glTextureStorage2D( DepthTextureID, 1, GL_R32F, Width, Height );
+   glTextureParameteri( DepthTextureID, GL_TEXTURE_MIN_FILTER, GL_NEAREST );
+   glTextureParameteri( DepthTextureID, GL_TEXTURE_MAG_FILTER, GL_NEAREST );
+}
+
+void ContactShadowGL::setDepthView(const CameraGL* camera)
+{
+   // The depth of this frame is marched in the next one, so its view is kept to march and reproject it.
+   DepthViewMatrix = camera->getViewMatrix();
+   DepthProjectionMatrix = camera->getProjectionMatrix();
+   DepthReversedZ = camera->isReversedZ();
+
+   // The NDC is mapped to the half resolution texel coordinates, where the texel i stands for the full resolution
+   // pixel 2i. The w of the perspective projection is the view depth, which is kept for the upsampling weights.
+   const glm::vec2 scale = 0.25f * glm::vec2(camera->getWidth(), camera->getHeight());
+   glm::mat4 to_texel(1.0f);
+   to_texel[0][0] = scale.x;
+   to_texel[1][1] = scale.y;
+   to_texel[3][0] = scale.x - 0.25f;
+   to_texel[3][1] = scale.y - 0.25f;
+   ReprojectionMatrix = to_texel * DepthProjectionMatrix * DepthViewMatrix;
+   HasDepthView = true;
+}
+
+void ContactShadowGL::march(const ShaderGL* contact_shader, GLuint depth_texture, const LightGL* lights) const
+{
+   glUseProgram( contact_shader->getShaderProgram() );
+   const GLint binding = contact_shader->getStorageBlockBinding( "LightBuffer" );
+   if (binding >= 0) glBindBufferBase( GL_SHADER_STORAGE_BUFFER, static_cast<GLuint>(binding), lights->getLightBuffer() );
+   const glm::mat4 inverse_projection = glm::inverse( DepthProjectionMatrix );
+   glUniformMatrix4fv( contact_shader->getUniformLocation( "ViewMatrix" ), 1, GL_FALSE, &DepthViewMatrix[0][0] );
+   glUniformMatrix4fv(
+      contact_shader->getUniformLocation( "ProjectionMatrix" ), 1, GL_FALSE, &DepthProjectionMatrix[0][0]
+   );
+   glUniformMatrix4fv(
+      contact_shader->getUniformLocation( "InverseProjectionMatrix" ), 1, GL_FALSE, &inverse_projection[0][0]
+   );
+   glUniform1i( contact_shader->getUniformLocation( "StepNum" ), StepNum );
+   glUniform1f( contact_shader->getUniformLocation( "RayLength" ), RayLength );
+   glUniform1f( contact_shader->getUniformLocation( "Thickness" ), Thickness );
+   glUniform1f( contact_shader->getUniformLocation( "FarDepth" ), DepthReversedZ ? 0.0f : 1.0f );
+   glBindTextureUnit( 0, depth_texture );
+   glBindImageTexture( 0, FactorTextureID, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_RGBA8 );
+   glBindImageTexture( 1, DepthTextureID, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_R32F );
+   glDispatchCompute(
+      static_cast<GLuint>((Width + ThreadGroupSize - 1) / ThreadGroupSize),
+      static_cast<GLuint>((Height + ThreadGroupSize - 1) / ThreadGroupSize),
+      1
+   );
+   glMemoryBarrier( GL_TEXTURE_FETCH_BARRIER_BIT );
+}
+
+void ContactShadowGL::transferUniformsToShader(const ShaderGL* shader) const
+{
+   glBindTextureUnit( 8, FactorTextureID );
+   glBindTextureUnit( 9, DepthTextureID );
+   glUniform1i( shader->getUniformLocation( "UseContactShadows" ), Enabled && HasDepthView ? 1 : 0 );
+   glUniformMatrix4fv(
+      shader->getUniformLocation( "ContactReprojectionMatrix" ), 1, GL_FALSE, &ReprojectionMatrix[0][0]
+   );
+}
\ No newline at end of file
@@ -0,0 +1,108 @@
+#include "depth_bounds.h"
+
+DepthBoundsGL::DepthBoundsGL() :
+   HasBounds( false ), Width( 0 ), Height( 0 ), FBO( 0 ), ColorTextureID( 0 ), DepthTextureID( 0 ), BoundsBuffer( 0 ),
+   ReadbackBuffer( 0 ), ReadbackFence( nullptr ), ReadbackProjection( 1.0f ), VisibleDepthRange( 0.0f )
+{
+}
+
+DepthBoundsGL::~DepthBoundsGL()
+{
+   deleteTargets();
+   if (BoundsBuffer != 0) glDeleteBuffers( 1, &BoundsBuffer );
+   if (ReadbackBuffer != 0) glDeleteBuffers( 1, &ReadbackBuffer );
+   if (ReadbackFence != nullptr) glDeleteSync( ReadbackFence );
+}
+
+void DepthBoundsGL::deleteTargets()
+{
+   if (ColorTextureID != 0) glDeleteTextures( 1, &ColorTextureID );
+   if (DepthTextureID != 0) glDeleteTextures( 1, &DepthTextureID );
+   if (FBO != 0) glDeleteFramebuffers( 1, &FBO );
+   ColorTextureID = DepthTextureID = FBO = 0;
+}
+
+void DepthBoundsGL::resize(int width, int height)
+{
+   if (width == Width && height == Height && FBO != 0) return;
+
+   // The main pass is rendered off the screen, because the depth of the default framebuffer cannot be sampled.
+   deleteTargets();
+   Width = std::max( width, 1 );
+   Height = std::max( height, 1 );
+   glCreateTextures( GL_TEXTURE_2D, 1, &ColorTextureID );
+   glTextureStorage2D( ColorTextureID, 1, GL_RGBA8, Width, Height );
+   glCreateTextures( GL_TEXTURE_2D, 1, &DepthTextureID );
+   glTextureStorage2D( DepthTextureID, 1, GL_DEPTH_COMPONENT32F, Width, Height );
+   glTextureParameteri( DepthTextureID, GL_TEXTURE_MIN_FILTER, GL_NEAREST );
+   glTextureParameteri( DepthTextureID, GL_TEXTURE_MAG_FILTER, GL_NEAREST );
+
+   glCreateFramebuffers( 1, &FBO );
+   glNamedFramebufferTexture( FBO, GL_COLOR_ATTACHMENT0, ColorTextureID, 0 );
+   glNamedFramebufferTexture( FBO, GL_DEPTH_ATTACHMENT, DepthTextureID, 0 );
+
+   if (BoundsBuffer == 0) {
+      glCreateBuffers( 1, &BoundsBuffer );
+      glNamedBufferStorage( BoundsBuffer, sizeof( GLuint ) * 2, nullptr, GL_DYNAMIC_STORAGE_BIT );
+      glCreateBuffers( 1, &ReadbackBuffer );
+      glNamedBufferStorage( ReadbackBuffer, sizeof( GLuint ) * 2, nullptr, GL_DYNAMIC_STORAGE_BIT );
+   }
+}
+
+void DepthBoundsGL::reduce(const ShaderGL* reduction_shader, const CameraGL* camera)
+{
+   // The positive depth keeps its order as an unsigned integer, so the bounds are reduced with the integer atomics.
+   const std::array<GLuint, 2> empty_bounds{ std::numeric_limits<GLuint>::max(), 0u };
+   glNamedBufferSubData( BoundsBuffer, 0, sizeof( GLuint ) * 2, empty_bounds.data() );
+
+   glUseProgram( reduction_shader->getShaderProgram() );
+   const GLint binding = reduction_shader->getStorageBlockBinding( "DepthBoundsBuffer" );
+   if (binding >= 0) glBindBufferBase( GL_SHADER_STORAGE_BUFFER, static_cast<GLuint>(binding), BoundsBuffer );
+   glUniform1f( reduction_shader->getUniformLocation( "FarDepth" ), camera->isReversedZ() ? 0.0f : 1.0f );
+   glBindTextureUnit( 0, DepthTextureID );
+   glDispatchCompute(
+      static_cast<GLuint>((Width + ThreadGroupSize - 1) / ThreadGroupSize),
+      static_cast<GLuint>((Height + ThreadGroupSize - 1) / ThreadGroupSize),
+      1
+   );
+   glMemoryBarrier( GL_BUFFER_UPDATE_BARRIER_BIT );
+
+   // Only one readback is in flight, so the frames in between are reduced but not read.
+   if (ReadbackFence != nullptr) return;
+   glCopyNamedBufferSubData( BoundsBuffer, ReadbackBuffer, 0, 0, sizeof( GLuint ) * 2 );
+   ReadbackFence = glFenceSync( GL_SYNC_GPU_COMMANDS_COMPLETE, 0 );
+   ReadbackProjection = camera->getProjectionMatrix();
+}
+
+void DepthBoundsGL::collectBounds()
+{
+   // The fence is only polled, so that the CPU never waits for the GPU.
+   if (ReadbackFence == nullptr) return;
+   const GLenum status = glClientWaitSync( ReadbackFence, 0, 0 );
+   if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED) return;
+   glDeleteSync( ReadbackFence );
+   ReadbackFence = nullptr;
+
+   std::array<GLuint, 2> bounds{};
+   glGetNamedBufferSubData( ReadbackBuffer, 0, sizeof( GLuint ) * 2, bounds.data() );
+   if (bounds[0] > bounds[1]) {
+      HasBounds = false;
+      return;
+   }
+
+   // The window depth, which is the depth in NDC for the zero-to-one clip control, is converted to the distance
+   // from the camera along the view direction. The reversed depth decreases with the distance.
+   const auto getDistance = [this](GLuint depth_bits) {
+      return ReadbackProjection[3][2] / (glm::uintBitsToFloat( depth_bits ) + ReadbackProjection[2][2]);
+   };
+   const float min_distance = getDistance( bounds[0] );
+   const float max_distance = getDistance( bounds[1] );
+   VisibleDepthRange.x = std::min( min_distance, max_distance ) * (1.0f - DepthMargin);
+   VisibleDepthRange.y = std::max( min_distance, max_distance ) * (1.0f + DepthMargin);
+   HasBounds = true;
+}
+
+void DepthBoundsGL::blitToScreen() const
+{
+   glBlitNamedFramebuffer( FBO, 0, 0, 0, Width, Height, 0, 0, Width, Height, GL_COLOR_BUFFER_BIT, GL_NEAREST );
+}
\ No newline at end of file
@@ -1,8 +1,27 @@
 #include "light.h"
 
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define USE_SSE_LIGHT_CULLING
+#include <emmintrin.h>
+#endif
+
+static_assert( sizeof( LightGL::LightInfo ) == 96, "LightInfo should match the std430 layout" );
+static_assert( sizeof( LightGL::LightBufferHeader ) == 32, "LightBufferHeader should match the std430 layout" );
+
 LightGL::LightGL() :
-   TurnLightOn( true ), GlobalAmbientColor( 0.2f, 0.2f, 0.2f, 1.0f ), TotalLightNum( 0 )
+   TurnLightOn( true ), IsHeaderDirty( true ), UseLightClusters( true ), TotalLightNum( 0 ), LightCapacity( 0 ),
+   LightBuffer( 0 ), ClusterBuffer( 0 ), ClusterLightIndexBuffer( 0 ),
+   ObjectLightIndexBuffer( 0 ), ObjectLightIndexCapacity( 0 ), ClusterTileSize( 1.0f ), ClusterDepthRange( 1.0f ),
+   GlobalAmbientColor( 0.2f, 0.2f, 0.2f, 1.0f )
+{
+}
+
+LightGL::~LightGL()
 {
+   if (LightBuffer != 0) glDeleteBuffers( 1, &LightBuffer );
+   if (ClusterBuffer != 0) glDeleteBuffers( 1, &ClusterBuffer );
+   if (ClusterLightIndexBuffer != 0) glDeleteBuffers( 1, &ClusterLightIndexBuffer );
+   if (ObjectLightIndexBuffer != 0) glDeleteBuffers( 1, &ObjectLightIndexBuffer );
 }
 
 bool LightGL::isLightOn() const
@@ -13,6 +32,7 @@ bool LightGL::isLightOn() const
 void LightGL::toggleLightSwitch()
 {
    TurnLightOn = !TurnLightOn;
+   IsHeaderDirty = true;
 }
 
 void LightGL::addLight(
@@ -26,49 +46,315 @@ void LightGL::addLight(
    float falloff_radius
 )
 {
-   Positions.emplace_back( light_position );
+   LightInfo light{};
+   light.Position = light_position;
+   light.AmbientColor = ambient_color;
+   light.DiffuseColor = diffuse_color;
+   light.SpecularColor = specular_color;
+   light.SpotlightDirection = spotlight_direction;
+   light.SpotlightCutoffAngle = spotlight_cutoff_angle_in_degree;
+   light.SpotlightFeather = spotlight_feather;
+   light.FallOffRadius = falloff_radius;
+   light.LightSwitch = 1;
+   light.ShadowNormalOffset = DefaultNormalOffset;
+   Lights.emplace_back( light );
+   IsDirty.emplace_back( true );
+   ShadowDirty.emplace_back( true );
+   ShadowCasters.emplace_back( true );
+   DualParaboloidShadows.emplace_back( false );
+   ShadowDepthBiases.emplace_back( DefaultSlopeScaledBias, DefaultConstantBias );
 
-   AmbientColors.emplace_back( ambient_color );
-   DiffuseColors.emplace_back( diffuse_color );
-   SpecularColors.emplace_back( specular_color );
-
-   SpotlightDirections.emplace_back( spotlight_direction );
-   SpotlightCutoffAngles.emplace_back( spotlight_cutoff_angle_in_degree );
-   SpotlightFeathers.emplace_back( spotlight_feather );
-   FallOffRadii.emplace_back( falloff_radius );
-
-   IsActivated.emplace_back( true );
+   TotalLightNum = static_cast<int>(Lights.size());
+   IsHeaderDirty = true;
+   resizeLightVolumes();
+}
 
-   TotalLightNum = static_cast<int>(Positions.size());
+LightGL::ShadowType LightGL::getShadowType(int light_index) const
+{
+   const LightInfo& light = Lights[light_index];
+   if (!isShadowCaster( light_index )) return ShadowType::None;
+   if (light.Position.w == 0.0f) return ShadowType::Cascaded;
+   if (light.SpotlightCutoffAngle <= MaxSpotShadowCutoffAngle) return ShadowType::Spot;
+   return DualParaboloidShadows[light_index] ? ShadowType::DualParaboloid : ShadowType::CubeMap;
 }
 
 void LightGL::activateLight(const int& light_index)
 {
    if (light_index >= TotalLightNum) return;
-   IsActivated[light_index] = true;
+   Lights[light_index].LightSwitch = 1;
+   IsDirty[light_index] = true;
+   ShadowDirty[light_index] = true;
 }
 
 void LightGL::deactivateLight(const int& light_index)
 {
    if (light_index >= TotalLightNum) return;
-   IsActivated[light_index] = false;
+   Lights[light_index].LightSwitch = 0;
+   IsDirty[light_index] = true;
+   ShadowDirty[light_index] = true;
+}
+
+void LightGL::reserveLightBuffer()
+{
+   if (LightBuffer != 0 && TotalLightNum <= LightCapacity) return;
+
+   // The buffer storage is immutable, so a larger buffer is created and every light is uploaded again.
+   LightCapacity = std::max( 64, LightCapacity );
+   while (LightCapacity < TotalLightNum) LightCapacity *= 2;
+   if (LightBuffer != 0) glDeleteBuffers( 1, &LightBuffer );
+
+   glCreateBuffers( 1, &LightBuffer );
+   glNamedBufferStorage(
+      LightBuffer,
+      static_cast<GLsizeiptr>(sizeof( LightBufferHeader ) + sizeof( LightInfo ) * LightCapacity),
+      nullptr,
+      GL_DYNAMIC_STORAGE_BIT
+   );
+   std::fill( IsDirty.begin(), IsDirty.end(), true );
+   IsHeaderDirty = true;
+}
+
+void LightGL::uploadLights(int begin, int end) const
+{
+   glNamedBufferSubData(
+      LightBuffer,
+      static_cast<GLintptr>(sizeof( LightBufferHeader ) + sizeof( LightInfo ) * begin),
+      static_cast<GLsizeiptr>(sizeof( LightInfo ) * (end - begin)),
+      &Lights[begin]
+   );
+}
+
+void LightGL::updateLightBuffer()
+{
+   reserveLightBuffer();
+
+   if (IsHeaderDirty) {
+      LightBufferHeader header{};
+      header.GlobalAmbientColor = GlobalAmbientColor;
+      header.UseLight = TurnLightOn ? 1 : 0;
+      header.LightNum = TotalLightNum;
+      glNamedBufferSubData( LightBuffer, 0, sizeof( LightBufferHeader ), &header );
+      IsHeaderDirty = false;
+   }
+
+   // Only the runs of lights changed since the last update are uploaded.
+   for (int i = 0; i < TotalLightNum;) {
+      if (!IsDirty[i]) {
+         ++i;
+         continue;
+      }
+
+      int end = i + 1;
+      while (end < TotalLightNum && IsDirty[end]) ++end;
+      uploadLights( i, end );
+      for (int j = i; j < end; ++j) updateLightVolume( j );
+      std::fill( IsDirty.begin() + i, IsDirty.begin() + end, false );
+      i = end;
+   }
+}
+
+void LightGL::createClusterBuffers()
+{
+   // Each cluster has the offset and number of its lights in the index buffer.
+   glCreateBuffers( 1, &ClusterBuffer );
+   glNamedBufferStorage( ClusterBuffer, sizeof( glm::uvec2 ) * ClusterNum, nullptr, 0 );
+
+   // The index buffer starts with the number of indices written so far, and the indices follow it.
+   glCreateBuffers( 1, &ClusterLightIndexBuffer );
+   glNamedBufferStorage(
+      ClusterLightIndexBuffer,
+      static_cast<GLsizeiptr>(sizeof( GLuint ) * (1 + ClusterNum * AverageLightsPerCluster)),
+      nullptr,
+      GL_DYNAMIC_STORAGE_BIT
+   );
+}
+
+void LightGL::bindStorageBuffer(const ShaderGL* shader, const char* block_name, GLuint buffer) const
+{
+   const GLint binding = shader->getStorageBlockBinding( block_name );
+   if (binding >= 0) glBindBufferBase( GL_SHADER_STORAGE_BUFFER, static_cast<GLuint>(binding), buffer );
+}
+
+void LightGL::buildLightClusters(const ShaderGL* clustering_shader, const CameraGL* camera)
+{
+   if (!UseLightClusters) return;
+   if (ClusterBuffer == 0) createClusterBuffers();
+
+   ClusterTileSize = glm::vec2(
+      static_cast<float>(camera->getWidth()) / static_cast<float>(ClusterGridX),
+      static_cast<float>(camera->getHeight()) / static_cast<float>(ClusterGridY)
+   );
+   // The exponential slices would be too thin near the camera if they started from the near plane.
+   ClusterDepthRange = glm::vec2(std::max( camera->getNearPlane(), 1.0f ), camera->getFarPlane());
+
+   glUseProgram( clustering_shader->getShaderProgram() );
+   bindStorageBuffer( clustering_shader, "LightBuffer", LightBuffer );
+   bindStorageBuffer( clustering_shader, "ClusterBuffer", ClusterBuffer );
+   bindStorageBuffer( clustering_shader, "ClusterLightIndexBuffer", ClusterLightIndexBuffer );
+
+   const glm::mat4 inverse_projection = glm::inverse( camera->getProjectionMatrix() );
+   glUniformMatrix4fv( clustering_shader->getUniformLocation( "ViewMatrix" ), 1, GL_FALSE, &camera->getViewMatrix()[0][0] );
+   glUniformMatrix4fv( clustering_shader->getUniformLocation( "InverseProjectionMatrix" ), 1, GL_FALSE, &inverse_projection[0][0] );
+   glUniform2fv( clustering_shader->getUniformLocation( "ClusterDepthRange" ), 1, &ClusterDepthRange[0] );
+   glUniform1ui( clustering_shader->getUniformLocation( "MaxClusterLightIndexNum" ), ClusterNum * AverageLightsPerCluster );
+
+   const GLuint zero = 0;
+   glClearNamedBufferSubData( ClusterLightIndexBuffer, GL_R32UI, 0, sizeof( GLuint ), GL_RED_INTEGER, GL_UNSIGNED_INT, &zero );
+   glDispatchCompute( 1, 1, ClusterGridZ );
+   glMemoryBarrier( GL_SHADER_STORAGE_BARRIER_BIT );
 }
 
-void LightGL::transferUniformsToShader(const ShaderGL* shader)
+void LightGL::resizeLightVolumes()
 {
-   glUniform1i( shader->getLightAvailabilityLocation(), TurnLightOn ? 1 : 0 );
-   glUniform1i( shader->getLightNumLocation(), static_cast<GLint>(TotalLightNum) );
-   glUniform4fv( shader->getGlobalAmbientLocation(), 1, &GlobalAmbientColor[0] );
+   const size_t padded_num = (Lights.size() + 3) / 4 * 4;
+   for (auto* values : { &Volumes.X, &Volumes.Y, &Volumes.Z, &Volumes.DirectionX, &Volumes.DirectionY, &Volumes.DirectionZ }) {
+      values->resize( padded_num, 0.0f );
+   }
+   Volumes.Radius.resize( padded_num, -std::numeric_limits<float>::max() );
+   Volumes.CosCutoff.resize( padded_num, -2.0f );
+   Volumes.SinCutoff.resize( padded_num, 0.0f );
+}
 
-   for (int i = 0; i < TotalLightNum; ++i) {
-      glUniform1i( shader->getLightSwitchLocation( i ), IsActivated[0] ? 1 : 0 );
-      glUniform4fv( shader->getLightPositionLocation( i ), 1, &Positions[i][0] );
-      glUniform4fv( shader->getLightAmbientLocation( i ), 1, &AmbientColors[i][0] );
-      glUniform4fv( shader->getLightDiffuseLocation( i ), 1, &DiffuseColors[i][0] );
-      glUniform4fv( shader->getLightSpecularLocation( i ), 1, &SpecularColors[i][0] );
-      glUniform3fv( shader->getLightSpotlightDirectionLocation( i ), 1, &SpotlightDirections[i][0] );
-      glUniform1f( shader->getLightSpotlightCutoffAngleLocation( i ), SpotlightCutoffAngles[i] );
-      glUniform1f( shader->getLightSpotlightFeatherLocation( i ), SpotlightFeathers[i] );
-      glUniform1f( shader->getLightFallOffRadiusLocation( i ), FallOffRadii[i] );
+void LightGL::updateLightVolume(int light_index)
+{
+   const LightInfo& light = Lights[light_index];
+   if (light.LightSwitch == 0) Volumes.Radius[light_index] = -std::numeric_limits<float>::max();
+   else if (light.Position.w == 0.0f) {
+      Volumes.X[light_index] = Volumes.Y[light_index] = Volumes.Z[light_index] = 0.0f;
+      Volumes.Radius[light_index] = 1e+18f;
    }
+   else {
+      Volumes.X[light_index] = light.Position.x / light.Position.w;
+      Volumes.Y[light_index] = light.Position.y / light.Position.w;
+      Volumes.Z[light_index] = light.Position.z / light.Position.w;
+      Volumes.Radius[light_index] = getInfluenceRadius( light.FallOffRadius );
+   }
+
+   if (light.SpotlightCutoffAngle >= 180.0f || light.Position.w == 0.0f) {
+      Volumes.CosCutoff[light_index] = -2.0f;
+      Volumes.SinCutoff[light_index] = 0.0f;
+   }
+   else {
+      const glm::vec3 direction = glm::normalize( light.SpotlightDirection );
+      const float cutoff_angle = glm::radians( glm::clamp( light.SpotlightCutoffAngle, 0.0f, 90.0f ) );
+      Volumes.DirectionX[light_index] = direction.x;
+      Volumes.DirectionY[light_index] = direction.y;
+      Volumes.DirectionZ[light_index] = direction.z;
+      Volumes.CosCutoff[light_index] = std::cos( cutoff_angle );
+      Volumes.SinCutoff[light_index] = std::sin( cutoff_angle );
+   }
+}
+
+// A light affects the sphere if the sphere touches its influence sphere and, for a spotlight, its cone.
+// The cone test is the sphere-cone test of the clustering pass, and the CosCutoff of -2 means there is no cone.
+void LightGL::cullLights(const glm::vec4& bounding_sphere, std::vector<GLuint>& light_indices) const
+{
+   const auto padded_num = static_cast<int>(Volumes.Radius.size());
+#ifdef USE_SSE_LIGHT_CULLING
+   const __m128 zero = _mm_setzero_ps();
+   const __m128 no_cone = _mm_set1_ps( -1.0f );
+   const __m128 all_bits = _mm_castsi128_ps( _mm_set1_epi32( -1 ) );
+   const __m128 center_x = _mm_set1_ps( bounding_sphere.x );
+   const __m128 center_y = _mm_set1_ps( bounding_sphere.y );
+   const __m128 center_z = _mm_set1_ps( bounding_sphere.z );
+   const __m128 radius = _mm_set1_ps( bounding_sphere.w );
+   const __m128 negative_radius = _mm_set1_ps( -bounding_sphere.w );
+   for (int i = 0; i < padded_num; i += 4) {
+      const __m128 vx = _mm_sub_ps( center_x, _mm_loadu_ps( &Volumes.X[i] ) );
+      const __m128 vy = _mm_sub_ps( center_y, _mm_loadu_ps( &Volumes.Y[i] ) );
+      const __m128 vz = _mm_sub_ps( center_z, _mm_loadu_ps( &Volumes.Z[i] ) );
+      const __m128 squared_distance = _mm_add_ps( _mm_add_ps( _mm_mul_ps( vx, vx ), _mm_mul_ps( vy, vy ) ), _mm_mul_ps( vz, vz ) );
+      const __m128 light_radius = _mm_loadu_ps( &Volumes.Radius[i] );
+      const __m128 reach = _mm_add_ps( light_radius, radius );
+      const __m128 in_sphere = _mm_and_ps( _mm_cmpge_ps( reach, zero ), _mm_cmple_ps( squared_distance, _mm_mul_ps( reach, reach ) ) );
+
+      const __m128 cosine = _mm_loadu_ps( &Volumes.CosCutoff[i] );
+      const __m128 sine = _mm_loadu_ps( &Volumes.SinCutoff[i] );
+      const __m128 along_axis = _mm_add_ps(
+         _mm_add_ps( _mm_mul_ps( vx, _mm_loadu_ps( &Volumes.DirectionX[i] ) ), _mm_mul_ps( vy, _mm_loadu_ps( &Volumes.DirectionY[i] ) ) ),
+         _mm_mul_ps( vz, _mm_loadu_ps( &Volumes.DirectionZ[i] ) )
+      );
+      const __m128 perpendicular = _mm_sqrt_ps( _mm_max_ps( _mm_sub_ps( squared_distance, _mm_mul_ps( along_axis, along_axis ) ), zero ) );
+      const __m128 closest_distance = _mm_sub_ps( _mm_mul_ps( cosine, perpendicular ), _mm_mul_ps( along_axis, sine ) );
+      const __m128 out_of_cone = _mm_or_ps(
+         _mm_cmpgt_ps( closest_distance, radius ),
+         _mm_or_ps( _mm_cmpgt_ps( along_axis, reach ), _mm_cmplt_ps( along_axis, negative_radius ) )
+      );
+      const __m128 in_cone = _mm_or_ps( _mm_cmplt_ps( cosine, no_cone ), _mm_andnot_ps( out_of_cone, all_bits ) );
+
+      const int mask = _mm_movemask_ps( _mm_and_ps( in_sphere, in_cone ) );
+      for (int b = 0; b < 4; ++b) {
+         if (mask & (1 << b)) light_indices.emplace_back( static_cast<GLuint>(i + b) );
+      }
+   }
+#else
+   for (int i = 0; i < padded_num; ++i) {
+      const glm::vec3 v = glm::vec3(bounding_sphere) - glm::vec3(Volumes.X[i], Volumes.Y[i], Volumes.Z[i]);
+      const float squared_distance = dot( v, v );
+      const float reach = Volumes.Radius[i] + bounding_sphere.w;
+      if (reach < 0.0f || squared_distance > reach * reach) continue;
+
+      if (Volumes.CosCutoff[i] >= -1.0f) {
+         const float along_axis = dot( v, glm::vec3(Volumes.DirectionX[i], Volumes.DirectionY[i], Volumes.DirectionZ[i]) );
+         const float perpendicular = std::sqrt( std::max( squared_distance - along_axis * along_axis, 0.0f ) );
+         const float closest_distance = Volumes.CosCutoff[i] * perpendicular - along_axis * Volumes.SinCutoff[i];
+         if (closest_distance > bounding_sphere.w || along_axis > reach || along_axis < -bounding_sphere.w) continue;
+      }
+      light_indices.emplace_back( static_cast<GLuint>(i) );
+   }
+#endif
+}
+
+void LightGL::cullLights(const std::vector<ObjectGL*>& objects)
+{
+   ObjectLightIndices.clear();
+   for (auto* object : objects) {
+      const auto offset = static_cast<int>(ObjectLightIndices.size());
+      cullLights( object->getBoundingSphereInWorld(), ObjectLightIndices );
+      object->setLightIndexRange( offset, static_cast<int>(ObjectLightIndices.size()) - offset );
+   }
+   if (ObjectLightIndices.empty()) return;
+
+   const auto index_num = static_cast<int>(ObjectLightIndices.size());
+   if (index_num > ObjectLightIndexCapacity) {
+      ObjectLightIndexCapacity = std::max( 256, ObjectLightIndexCapacity );
+      while (ObjectLightIndexCapacity < index_num) ObjectLightIndexCapacity *= 2;
+      if (ObjectLightIndexBuffer != 0) glDeleteBuffers( 1, &ObjectLightIndexBuffer );
+
+      glCreateBuffers( 1, &ObjectLightIndexBuffer );
+      glNamedBufferStorage(
+         ObjectLightIndexBuffer,
+         static_cast<GLsizeiptr>(sizeof( GLuint ) * ObjectLightIndexCapacity),
+         nullptr,
+         GL_DYNAMIC_STORAGE_BIT
+      );
+   }
+   glNamedBufferSubData(
+      ObjectLightIndexBuffer,
+      0,
+      static_cast<GLsizeiptr>(sizeof( GLuint ) * index_num),
+      ObjectLightIndices.data()
+   );
+}
+
+void LightGL::transferUniformsToShader(const ShaderGL* shader) const
+{
+   bindStorageBuffer( shader, "LightBuffer", LightBuffer );
+   bindStorageBuffer( shader, "ObjectLightIndexBuffer", ObjectLightIndexBuffer );
+   glUniform1i( shader->getUniformLocation( "UseLightClusters" ), UseLightClusters ? 1 : 0 );
+   if (!UseLightClusters) return;
+
+   bindStorageBuffer( shader, "ClusterBuffer", ClusterBuffer );
+   bindStorageBuffer( shader, "ClusterLightIndexBuffer", ClusterLightIndexBuffer );
+
+   // A fragment finds its depth slice by log(depth) * scale + bias.
+   const float log_depth_ratio = std::log( ClusterDepthRange.y / ClusterDepthRange.x );
+   const glm::vec2 depth_slice(
+      static_cast<float>(ClusterGridZ) / log_depth_ratio,
+      -static_cast<float>(ClusterGridZ) * std::log( ClusterDepthRange.x ) / log_depth_ratio
+   );
+   const glm::uvec3 grid_size(ClusterGridX, ClusterGridY, ClusterGridZ);
+   glUniform3uiv( shader->getUniformLocation( "ClusterGridSize" ), 1, &grid_size[0] );
+   glUniform2fv( shader->getUniformLocation( "ClusterTileSize" ), 1, &ClusterTileSize[0] );
+   glUniform2fv( shader->getUniformLocation( "ClusterDepthSlice" ), 1, &depth_slice[0] );
 }
\ No newline at end of file
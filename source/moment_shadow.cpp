@@ -0,0 +1,77 @@
+#include "moment_shadow.h"
+
+MomentShadowGL::MomentShadowGL(int blur_radius, float light_bleeding_reduction) :
+   MomentType( Type::None ), BlurRadius( blur_radius ), LightBleedingReduction( light_bleeding_reduction ),
+   MomentAtlasID( 0 ), HorizontalMomentsID( 0 )
+{
+}
+
+MomentShadowGL::~MomentShadowGL()
+{
+   deleteMomentAtlas();
+}
+
+void MomentShadowGL::deleteMomentAtlas()
+{
+   if (MomentAtlasID != 0) glDeleteTextures( 1, &MomentAtlasID );
+   if (HorizontalMomentsID != 0) glDeleteTextures( 1, &HorizontalMomentsID );
+   MomentAtlasID = HorizontalMomentsID = 0;
+   MomentType = Type::None;
+}
+
+void MomentShadowGL::createMomentAtlas(Type type, int atlas_size, int max_tile_size)
+{
+   deleteMomentAtlas();
+   MomentType = type;
+   if (MomentType == Type::None) return;
+
+   // The moments are filtered like colors, so the atlas is mipmapped and sampled trilinearly.
+   glCreateTextures( GL_TEXTURE_2D, 1, &MomentAtlasID );
+   glTextureStorage2D( MomentAtlasID, MomentLevelNum, getMomentFormat(), atlas_size, atlas_size );
+   glTextureParameteri( MomentAtlasID, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR );
+   glTextureParameteri( MomentAtlasID, GL_TEXTURE_MAG_FILTER, GL_LINEAR );
+   glTextureParameteri( MomentAtlasID, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE );
+   glTextureParameteri( MomentAtlasID, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE );
+
+   glCreateTextures( GL_TEXTURE_2D, 1, &HorizontalMomentsID );
+   glTextureStorage2D( HorizontalMomentsID, 1, GL_RGBA32F, max_tile_size, max_tile_size );
+}
+
+void MomentShadowGL::updateTile(const ShaderGL* moment_shader, const ShadowAtlasGL* shadow_atlas, int light_index) const
+{
+   // The first pass converts the depth of the tile to moments and blurs them horizontally,
+   // and the second one blurs them vertically into the moment atlas. The quantized moments are stored
+   // through their own image unit, because the format of an image is fixed in the shader.
+   const glm::ivec4& tile = shadow_atlas->getTile( light_index );
+   const auto group_num_x = static_cast<GLuint>((tile.z + ThreadGroupSize - 1) / ThreadGroupSize);
+   const auto group_num_y = static_cast<GLuint>((tile.w + ThreadGroupSize - 1) / ThreadGroupSize);
+   glUseProgram( moment_shader->getShaderProgram() );
+   glUniform4iv( moment_shader->getUniformLocation( "Tile" ), 1, &tile[0] );
+   glUniform2fv( moment_shader->getUniformLocation( "DepthRange" ), 1, &shadow_atlas->getDepthRange( light_index )[0] );
+   glUniform1i( moment_shader->getUniformLocation( "BlurRadius" ), BlurRadius );
+
+   shadow_atlas->bindRawDepthTexture( 0 );
+   glBindImageTexture( 0, HorizontalMomentsID, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_RGBA32F );
+   glUniform1i( moment_shader->getUniformLocation( "Pass" ), 0 );
+   glDispatchCompute( group_num_x, group_num_y, 1 );
+   glMemoryBarrier( GL_TEXTURE_FETCH_BARRIER_BIT );
+
+   glBindSampler( 0, 0 );
+   glBindTextureUnit( 1, HorizontalMomentsID );
+   const GLuint image_unit = MomentType == Type::FourMoments ? 1 : 0;
+   glBindImageTexture( image_unit, MomentAtlasID, 0, GL_FALSE, 0, GL_WRITE_ONLY, getMomentFormat() );
+   glUniform1i( moment_shader->getUniformLocation( "Pass" ), 1 );
+   glDispatchCompute( group_num_x, group_num_y, 1 );
+   glMemoryBarrier( GL_TEXTURE_FETCH_BARRIER_BIT | GL_TEXTURE_UPDATE_BARRIER_BIT );
+}
+
+void MomentShadowGL::generateMipmaps() const
+{
+   glGenerateTextureMipmap( MomentAtlasID );
+}
+
+void MomentShadowGL::transferUniformsToShader(const ShaderGL* shader) const
+{
+   glUniform1f( shader->getUniformLocation( "LightBleedingReduction" ), LightBleedingReduction );
+   glBindTextureUnit( 6, MomentAtlasID );
+}
\ No newline at end of file
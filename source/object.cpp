@@ -1,7 +1,8 @@
 #include "object.h"
 
 ObjectGL::ObjectGL() :
-   ImageBuffer( nullptr ), VAO( 0 ), VBO( 0 ), DrawMode( 0 ), VerticesCount( 0 ),
+   IsStatic( false ), IsDirty( true ), IsShadowCaster( true ), IsShadowReceiver( true ), ImageBuffer( nullptr ), VAO( 0 ), VBO( 0 ), DrawMode( 0 ), VerticesCount( 0 ), LightIndexOffset( 0 ),
+   LightIndexNum( 0 ), BoundingSphere( 0.0f ), WorldMatrix( 1.0f ),
    EmissionColor( 0.0f, 0.0f, 0.0f, 1.0f ),
    AmbientReflectionColor( 0.2f, 0.2f, 0.2f, 1.0f ),
    DiffuseReflectionColor( 0.8f, 0.8f, 0.8f, 1.0f ),
@@ -147,8 +148,44 @@ void ObjectGL::prepareNormal() const
    glVertexArrayAttribBinding( VAO, NormalLoc, 0 );
 }
 
+void ObjectGL::updateBoundingSphere(int n_floats_per_vertex)
+{
+   if (VerticesCount == 0) return;
+
+   // The sphere is centered at the center of the bounding box, which is tight enough for culling.
+   glm::vec3 min_point(std::numeric_limits<float>::max());
+   glm::vec3 max_point(std::numeric_limits<float>::lowest());
+   for (GLsizei i = 0; i < VerticesCount; ++i) {
+      const glm::vec3 vertex(glm::make_vec3( &DataBuffer[i * n_floats_per_vertex] ));
+      min_point = glm::min( min_point, vertex );
+      max_point = glm::max( max_point, vertex );
+   }
+
+   const glm::vec3 center = 0.5f * (min_point + max_point);
+   float squared_radius = 0.0f;
+   for (GLsizei i = 0; i < VerticesCount; ++i) {
+      const glm::vec3 d = glm::make_vec3( &DataBuffer[i * n_floats_per_vertex] ) - center;
+      squared_radius = std::max( squared_radius, dot( d, d ) );
+   }
+   BoundingSphere = glm::vec4(center, std::sqrt( squared_radius ));
+   IsDirty = true;
+}
+
+glm::vec4 ObjectGL::getBoundingSphereInWorld() const
+{
+   const glm::vec4 center = WorldMatrix * glm::vec4(glm::vec3(BoundingSphere), 1.0f);
+   const float scale = std::sqrt( std::max( {
+      dot( glm::vec3(WorldMatrix[0]), glm::vec3(WorldMatrix[0]) ),
+      dot( glm::vec3(WorldMatrix[1]), glm::vec3(WorldMatrix[1]) ),
+      dot( glm::vec3(WorldMatrix[2]), glm::vec3(WorldMatrix[2]) )
+   } ) );
+   return glm::vec4(glm::vec3(center), BoundingSphere.w * scale);
+}
+
 void ObjectGL::prepareVertexBuffer(int n_bytes_per_vertex)
 {
+   updateBoundingSphere( n_bytes_per_vertex / static_cast<int>(sizeof( GLfloat )) );
+
    glCreateBuffers( 1, &VBO );
    glNamedBufferStorage( VBO, sizeof( GLfloat ) * DataBuffer.size(), DataBuffer.data(), GL_DYNAMIC_STORAGE_BIT );
 
@@ -407,11 +444,14 @@ void ObjectGL::setSquareObject(
 
 void ObjectGL::transferUniformsToShader(const ShaderGL* shader)
 {
-   glUniform4fv( shader->getMaterialEmissionLocation(), 1, &EmissionColor[0] );
-   glUniform4fv( shader->getMaterialAmbientLocation(), 1, &AmbientReflectionColor[0] );
-   glUniform4fv( shader->getMaterialDiffuseLocation(), 1, &DiffuseReflectionColor[0] );
-   glUniform4fv( shader->getMaterialSpecularLocation(), 1, &SpecularReflectionColor[0] );
-   glUniform1f( shader->getMaterialSpecularExponentLocation(), SpecularReflectionExponent );
+   glUniform4fv( shader->getLocation( ShaderGL::MaterialEmissionLoc ), 1, &EmissionColor[0] );
+   glUniform4fv( shader->getLocation( ShaderGL::MaterialAmbientLoc ), 1, &AmbientReflectionColor[0] );
+   glUniform4fv( shader->getLocation( ShaderGL::MaterialDiffuseLoc ), 1, &DiffuseReflectionColor[0] );
+   glUniform4fv( shader->getLocation( ShaderGL::MaterialSpecularLoc ), 1, &SpecularReflectionColor[0] );
+   glUniform1f( shader->getLocation( ShaderGL::MaterialSpecularExponentLoc ), SpecularReflectionExponent );
+   glUniform1i( shader->getLocation( ShaderGL::ObjectLightIndexOffsetLoc ), LightIndexOffset );
+   glUniform1i( shader->getLocation( ShaderGL::ObjectLightIndexNumLoc ), LightIndexNum );
+   glUniform1i( shader->getLocation( ShaderGL::ReceiveShadowsLoc ), IsShadowReceiver ? 1 : 0 );
 }
 
 void ObjectGL::updateDataBuffer(const std::vector<glm::vec3>& vertices, const std::vector<glm::vec3>& normals)
@@ -429,6 +469,7 @@ void ObjectGL::updateDataBuffer(const std::vector<glm::vec3>& vertices, const st
       DataBuffer.push_back( normals[i].z );
       VerticesCount++;
    }
+   updateBoundingSphere( 6 );
    glNamedBufferSubData( VBO, 0, static_cast<GLsizeiptr>(sizeof( GLfloat ) * DataBuffer.size()), DataBuffer.data() );
 }
 
@@ -453,6 +494,7 @@ void ObjectGL::updateDataBuffer(
       DataBuffer.push_back( textures[i].y );
       VerticesCount++;
    }
+   updateBoundingSphere( 8 );
    glNamedBufferSubData( VBO, 0, static_cast<GLsizeiptr>(sizeof( GLfloat ) * DataBuffer.size()), DataBuffer.data() );
 }
 
@@ -474,6 +516,7 @@ void ObjectGL::replaceVertices(
       DataBuffer[i * step + 2] = vertices[i].z;
       VerticesCount++;
    }
+   updateBoundingSphere( step );
    glNamedBufferSubData( VBO, 0, static_cast<GLsizeiptr>(sizeof( GLfloat ) * VerticesCount * step), DataBuffer.data() );
 }
 
@@ -495,5 +538,6 @@ void ObjectGL::replaceVertices(
       DataBuffer[j * step + 2] = vertices[i + 2];
       VerticesCount++;
    }
+   updateBoundingSphere( step );
    glNamedBufferSubData( VBO, 0, static_cast<GLsizeiptr>(sizeof( GLfloat ) * VerticesCount * step), DataBuffer.data() );
 }
\ No newline at end of file
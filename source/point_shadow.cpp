@@ -0,0 +1,212 @@
+#include "point_shadow.h"
+
+static_assert( sizeof( PointShadowGL::PointShadowInfo ) == 32, "PointShadowInfo should match the std430 layout" );
+
+PointShadowGL::PointShadowGL(int map_size, int max_light_num, GLenum depth_format) :
+   MapSize( map_size ), MaxLightNum( max_light_num ), ShadowCapacity( 0 ), DepthFormat( depth_format ), ReversedZ( false ), CubeMapFBO( 0 ), ParaboloidFBO( 0 ),
+   CubeMapArrayID( 0 ), ParaboloidArrayID( 0 ), StaticCubeMapFBO( 0 ), StaticParaboloidFBO( 0 ),
+   StaticCubeMapArrayID( 0 ), StaticParaboloidArrayID( 0 ), ShadowBuffer( 0 )
+{
+}
+
+PointShadowGL::~PointShadowGL()
+{
+   deleteShadowMaps();
+   if (ShadowBuffer != 0) glDeleteBuffers( 1, &ShadowBuffer );
+}
+
+void PointShadowGL::deleteShadowMaps()
+{
+   for (auto* texture : { &CubeMapArrayID, &ParaboloidArrayID, &StaticCubeMapArrayID, &StaticParaboloidArrayID }) {
+      if (*texture != 0) glDeleteTextures( 1, texture );
+      *texture = 0;
+   }
+   for (auto* framebuffer : { &CubeMapFBO, &ParaboloidFBO, &StaticCubeMapFBO, &StaticParaboloidFBO }) {
+      if (*framebuffer != 0) glDeleteFramebuffers( 1, framebuffer );
+      *framebuffer = 0;
+   }
+}
+
+void PointShadowGL::createDepthArray(GLuint& texture, GLuint& framebuffer, GLenum target, int layer_num) const
+{
+   glCreateTextures( target, 1, &texture );
+   glTextureStorage3D( texture, 1, DepthFormat, MapSize, MapSize, layer_num );
+   glTextureParameteri( texture, GL_TEXTURE_MIN_FILTER, GL_LINEAR );
+   glTextureParameteri( texture, GL_TEXTURE_MAG_FILTER, GL_LINEAR );
+   glTextureParameteri( texture, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE );
+   glTextureParameteri( texture, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE );
+   glTextureParameteri( texture, GL_TEXTURE_COMPARE_MODE, GL_COMPARE_REF_TO_TEXTURE );
+   glTextureParameteri( texture, GL_TEXTURE_COMPARE_FUNC, ReversedZ ? GL_GEQUAL : GL_LEQUAL );
+
+   // The whole array is attached, so the geometry shader chooses the layer with gl_Layer.
+   glCreateFramebuffers( 1, &framebuffer );
+   glNamedFramebufferTexture( framebuffer, GL_DEPTH_ATTACHMENT, texture, 0 );
+}
+
+void PointShadowGL::createShadowMaps()
+{
+   // Each light owns 6 layers of the cube map array or 2 layers of the paraboloid array.
+   createDepthArray( CubeMapArrayID, CubeMapFBO, GL_TEXTURE_CUBE_MAP_ARRAY, 6 * MaxLightNum );
+   createDepthArray( ParaboloidArrayID, ParaboloidFBO, GL_TEXTURE_2D_ARRAY, 2 * MaxLightNum );
+   createDepthArray( StaticCubeMapArrayID, StaticCubeMapFBO, GL_TEXTURE_CUBE_MAP_ARRAY, 6 * MaxLightNum );
+   createDepthArray( StaticParaboloidArrayID, StaticParaboloidFBO, GL_TEXTURE_2D_ARRAY, 2 * MaxLightNum );
+}
+
+void PointShadowGL::recreateShadowMaps(int map_size, GLenum depth_format, bool reversed_z)
+{
+   // The layers are forgotten, so every light is assigned and rendered again as if it had new layers.
+   deleteShadowMaps();
+   MapSize = map_size;
+   DepthFormat = depth_format;
+   ReversedZ = reversed_z;
+   Shadows.clear();
+   createShadowMaps();
+}
+
+GLuint PointShadowGL::getDepthArray(int light_index, bool for_static_casters) const
+{
+   if (Shadows[light_index].Type == static_cast<int>(LightGL::ShadowType::CubeMap)) {
+      return for_static_casters ? StaticCubeMapArrayID : CubeMapArrayID;
+   }
+   return for_static_casters ? StaticParaboloidArrayID : ParaboloidArrayID;
+}
+
+void PointShadowGL::clearStaticLayers(int light_index) const
+{
+   const int layer_num = Shadows[light_index].Type == static_cast<int>(LightGL::ShadowType::CubeMap) ? 6 : 2;
+   const float farthest = ReversedZ ? 0.0f : 1.0f;
+   glClearTexSubImage(
+      getDepthArray( light_index, true ), 0,
+      0, 0, Shadows[light_index].Layer * layer_num, MapSize, MapSize, layer_num,
+      GL_DEPTH_COMPONENT, GL_FLOAT, &farthest
+   );
+}
+
+void PointShadowGL::copyStaticLayers(int light_index) const
+{
+   const int layer_num = Shadows[light_index].Type == static_cast<int>(LightGL::ShadowType::CubeMap) ? 6 : 2;
+   const GLenum target = Shadows[light_index].Type == static_cast<int>(LightGL::ShadowType::CubeMap) ?
+      GL_TEXTURE_CUBE_MAP_ARRAY : GL_TEXTURE_2D_ARRAY;
+   const int first_layer = Shadows[light_index].Layer * layer_num;
+   glCopyImageSubData(
+      getDepthArray( light_index, true ), target, 0, 0, 0, first_layer,
+      getDepthArray( light_index, false ), target, 0, 0, 0, first_layer,
+      MapSize, MapSize, layer_num
+   );
+}
+
+std::array<glm::mat4, 6> PointShadowGL::getCubeViewProjections(const glm::vec3& light_position, const glm::vec2& depth_range) const
+{
+   // The faces follow the order and the orientation of the cube map layers.
+   // The fragment shader writes the linear distance, so the projection only has to clip to the depth range.
+   const glm::mat4 projection = CameraGL::getPerspectiveProjection(
+      glm::radians( 90.0f ), 1.0f, depth_range.x, depth_range.y, ReversedZ
+   );
+   return {
+      projection * lookAt( light_position, light_position + glm::vec3(1.0f, 0.0f, 0.0f), glm::vec3(0.0f, -1.0f, 0.0f) ),
+      projection * lookAt( light_position, light_position + glm::vec3(-1.0f, 0.0f, 0.0f), glm::vec3(0.0f, -1.0f, 0.0f) ),
+      projection * lookAt( light_position, light_position + glm::vec3(0.0f, 1.0f, 0.0f), glm::vec3(0.0f, 0.0f, 1.0f) ),
+      projection * lookAt( light_position, light_position + glm::vec3(0.0f, -1.0f, 0.0f), glm::vec3(0.0f, 0.0f, -1.0f) ),
+      projection * lookAt( light_position, light_position + glm::vec3(0.0f, 0.0f, 1.0f), glm::vec3(0.0f, -1.0f, 0.0f) ),
+      projection * lookAt( light_position, light_position + glm::vec3(0.0f, 0.0f, -1.0f), glm::vec3(0.0f, -1.0f, 0.0f) )
+   };
+}
+
+void PointShadowGL::reserveShadowBuffer()
+{
+   const auto light_num = static_cast<int>(Shadows.size());
+   if (ShadowBuffer != 0 && light_num <= ShadowCapacity) return;
+
+   ShadowCapacity = std::max( 64, ShadowCapacity );
+   while (ShadowCapacity < light_num) ShadowCapacity *= 2;
+   if (ShadowBuffer != 0) glDeleteBuffers( 1, &ShadowBuffer );
+
+   glCreateBuffers( 1, &ShadowBuffer );
+   glNamedBufferStorage(
+      ShadowBuffer,
+      static_cast<GLsizeiptr>(sizeof( PointShadowInfo ) * ShadowCapacity),
+      nullptr,
+      GL_DYNAMIC_STORAGE_BIT
+   );
+}
+
+void PointShadowGL::assignLayers(const LightGL* lights, const std::array<glm::vec3, 2>& scene_bounds)
+{
+   const int light_num = lights->getTotalLightNum();
+   const std::vector<PointShadowInfo> previous_shadows = std::move( Shadows );
+   Shadows.assign( light_num, PointShadowInfo{} );
+
+   // The lights beyond the capacity of an array are left without shadows.
+   int cube_map_num = 0, paraboloid_num = 0;
+   for (int i = 0; i < light_num; ++i) {
+      const LightGL::ShadowType type = lights->getShadowType( i );
+      int* layer_num = type == LightGL::ShadowType::CubeMap ? &cube_map_num :
+         type == LightGL::ShadowType::DualParaboloid ? &paraboloid_num : nullptr;
+      if (layer_num == nullptr || *layer_num >= MaxLightNum) continue;
+
+      // The far distance is the farthest corner of the scene in the influence, in coarse steps so that
+      // the cached depth is not invalidated every time the light moves a little.
+      const glm::vec4 position = lights->getLightPosition( i );
+      const glm::vec3 light_position = glm::vec3(position) / position.w;
+      const float influence_radius = LightGL::getInfluenceRadius( lights->getLight( i ).FallOffRadius );
+      const glm::vec3 farthest = glm::max( glm::abs( scene_bounds[0] - light_position ), glm::abs( scene_bounds[1] - light_position ) );
+      const float step = influence_radius / 16.0f;
+      const float far_plane = glm::clamp( std::ceil( glm::length( farthest ) / step ) * step, NearPlane + step, influence_radius );
+      Shadows[i].DepthRange = glm::vec2(NearPlane, far_plane);
+      Shadows[i].Layer = (*layer_num)++;
+      Shadows[i].Type = static_cast<int>(type);
+   }
+
+   // The cached depth of a light is lost when it moves to other layers. Otherwise, the light keeps the position
+   // and the depth range its cached depth was rendered with until the depth is refreshed.
+   FittedDepthRanges.resize( light_num );
+   for (int i = 0; i < light_num; ++i) FittedDepthRanges[i] = Shadows[i].DepthRange;
+   ChangedLayers.assign( light_num, true );
+   ChangedDepthRanges.assign( light_num, false );
+   for (int i = 0; i < light_num && i < static_cast<int>(previous_shadows.size()); ++i) {
+      ChangedLayers[i] = Shadows[i].Layer != previous_shadows[i].Layer || Shadows[i].Type != previous_shadows[i].Type;
+      if (ChangedLayers[i]) continue;
+
+      ChangedDepthRanges[i] = Shadows[i].DepthRange != previous_shadows[i].DepthRange;
+      Shadows[i].Position = previous_shadows[i].Position;
+      Shadows[i].DepthRange = previous_shadows[i].DepthRange;
+   }
+}
+
+void PointShadowGL::updateShadowProjection(int light_index, const LightGL* lights)
+{
+   const glm::vec4 position = lights->getLightPosition( light_index );
+   Shadows[light_index].Position = glm::vec4(glm::vec3(position) / position.w, 1.0f);
+   Shadows[light_index].DepthRange = FittedDepthRanges[light_index];
+}
+
+void PointShadowGL::uploadShadowBuffer()
+{
+   if (Shadows.empty()) return;
+   reserveShadowBuffer();
+   glNamedBufferSubData( ShadowBuffer, 0, static_cast<GLsizeiptr>(sizeof( PointShadowInfo ) * Shadows.size()), Shadows.data() );
+}
+
+void PointShadowGL::transferLightUniformsToShader(const ShaderGL* shader, int light_index) const
+{
+   const PointShadowInfo& shadow = Shadows[light_index];
+   const glm::vec3 light_position = glm::vec3(shadow.Position);
+   const int layers_per_light = shadow.Type == static_cast<int>(LightGL::ShadowType::CubeMap) ? 6 : 2;
+   if (shadow.Type == static_cast<int>(LightGL::ShadowType::CubeMap)) {
+      const std::array<glm::mat4, 6> view_projections = getCubeViewProjections( light_position, shadow.DepthRange );
+      glUniformMatrix4fv(
+         shader->getUniformLocation( "LightViewProjectionMatrices" ), 6, GL_FALSE, &view_projections[0][0][0]
+      );
+   }
+   glUniform3fv( shader->getUniformLocation( "LightPosition" ), 1, &light_position[0] );
+   glUniform2fv( shader->getUniformLocation( "LightDepthRange" ), 1, &shadow.DepthRange[0] );
+   glUniform1i( shader->getUniformLocation( "LayerOffset" ), shadow.Layer * layers_per_light );
+}
+
+void PointShadowGL::transferUniformsToShader(const ShaderGL* shader) const
+{
+   const GLint binding = shader->getStorageBlockBinding( "PointShadowBuffer" );
+   if (binding >= 0) glBindBufferBase( GL_SHADER_STORAGE_BUFFER, static_cast<GLuint>(binding), ShadowBuffer );
+   glBindTextureUnit( 2, CubeMapArrayID );
+   glBindTextureUnit( 3, ParaboloidArrayID );
+}
\ No newline at end of file
@@ -1,12 +1,25 @@
 #include "renderer.h"
 
 RendererGL::RendererGL() :
-   Window( nullptr ), FrameWidth( 1920 ), FrameHeight( 1080 ), FBO( 0 ), DepthTextureID( 0 ),
-   ClickedPoint( -1, -1 ), LightTheta( 0.0f ), MainCamera( std::make_unique<CameraGL>() ),
+   Window( nullptr ), FrameWidth( 1920 ), FrameHeight( 1080 ),
+   ClickedPoint( -1, -1 ), LightTheta( 0.0f ), ShadowMapSize( 4096 ),
+   ShadowDepthFormatIndex( 2 ), PCFKernelSize( 3 ), UseSoftShadows( false ),
+   BlockerSearchSampleNum( 16 ), SoftShadowFilterSampleNum( 32 ), LightSize( 10.0f ),
+   MomentShadowType( MomentShadowGL::Type::None ), UseReversedZ( true ),
+   UseReceiverPlaneBias( true ), MainCamera( std::make_unique<CameraGL>() ),
    LightCamera( std::make_unique<CameraGL>() ), ObjectShader( std::make_unique<ShaderGL>() ),
-   ShadowShader( std::make_unique<ShaderGL>() ), GroundObject( std::make_unique<ObjectGL>() ),
-   TigerObject( std::make_unique<ObjectGL>() ), PandaObject( std::make_unique<ObjectGL>() ),
-   Lights( std::make_unique<LightGL>() )
+   ShadowShader( std::make_unique<ShaderGL>() ), LightClusteringShader( std::make_unique<ShaderGL>() ),
+   CubeShadowShader( std::make_unique<ShaderGL>() ), ParaboloidShadowShader( std::make_unique<ShaderGL>() ),
+   CascadedShadowShader( std::make_unique<ShaderGL>() ), DepthBoundsShader( std::make_unique<ShaderGL>() ),
+   ShadowMomentShader( std::make_unique<ShaderGL>() ), VirtualShadowShader( std::make_unique<ShaderGL>() ),
+   PageMarkingShader( std::make_unique<ShaderGL>() ), ContactShadowShader( std::make_unique<ShaderGL>() ),
+   GroundObject( std::make_unique<ObjectGL>() ), TigerObject( std::make_unique<ObjectGL>() ),
+   PandaObject( std::make_unique<ObjectGL>() ), Lights( std::make_unique<LightGL>() ),
+   ShadowAtlas( std::make_unique<ShadowAtlasGL>() ), PointShadow( std::make_unique<PointShadowGL>() ),
+   CascadedShadow( std::make_unique<CascadedShadowGL>() ), DepthBounds( std::make_unique<DepthBoundsGL>() ),
+   MomentShadow( std::make_unique<MomentShadowGL>() ),
+   ShadowScheduler( std::make_unique<ShadowSchedulerGL>() ), VirtualShadow( std::make_unique<VirtualShadowGL>() ),
+   ContactShadow( std::make_unique<ContactShadowGL>() )
 {
    Renderer = this;
 
@@ -14,11 +27,7 @@ RendererGL::RendererGL() :
    printOpenGLInformation();
 }
 
-RendererGL::~RendererGL()
-{
-   if (DepthTextureID != 0) glDeleteTextures( 1, &DepthTextureID );
-   if (FBO != 0) glDeleteFramebuffers( 1, &FBO );
-}
+RendererGL::~RendererGL() = default;
 
 void RendererGL::printOpenGLInformation()
 {
@@ -52,20 +61,43 @@ void RendererGL::initialize()
    registerCallbacks();
 
    glEnable( GL_DEPTH_TEST );
+   glEnable( GL_TEXTURE_CUBE_MAP_SEAMLESS );
    glClearColor( 0.1f, 0.1f, 0.1f, 1.0f );
 
    MainCamera->updateWindowSize( FrameWidth, FrameHeight );
    LightCamera->updateWindowSize( FrameWidth, FrameHeight );
+   setDepthConvention();
 
    const std::string shader_directory_path = std::string(CMAKE_SOURCE_DIR) + "/shaders";
    ObjectShader->setShader(
       std::string(shader_directory_path + "/BasicPipeline.vert").c_str(),
       std::string(shader_directory_path + "/BasicPipeline.frag").c_str()
    );
-   ShadowShader->setShader(
-      std::string(shader_directory_path + "/Shadow.vert").c_str(),
-      std::string(shader_directory_path + "/Shadow.frag").c_str()
+   createShadowShaders();
+   LightClusteringShader->setComputeShaders(
+      std::string(shader_directory_path + "/LightClustering.comp").c_str()
+   );
+   DepthBoundsShader->setComputeShaders(
+      std::string(shader_directory_path + "/DepthBounds.comp").c_str()
    );
+   VirtualShadowShader->setShader(
+      std::string(shader_directory_path + "/PointShadow.vert").c_str(),
+      std::string(shader_directory_path + "/BasicPipeline.frag").c_str(),
+      std::string(shader_directory_path + "/VirtualShadow.geom").c_str()
+   );
+   VirtualShadowShader->setBasicUniformLocations();
+   PageMarkingShader->setComputeShaders(
+      std::string(shader_directory_path + "/VirtualShadowMarking.comp").c_str()
+   );
+   ContactShadowShader->setComputeShaders(
+      std::string(shader_directory_path + "/ContactShadows.comp").c_str()
+   );
+   ObjectShader->enableHotReload();
+   LightClusteringShader->enableHotReload();
+   DepthBoundsShader->enableHotReload();
+   VirtualShadowShader->enableHotReload();
+   PageMarkingShader->enableHotReload();
+   ContactShadowShader->enableHotReload();
 }
 
 void RendererGL::cleanup(GLFWwindow* window)
@@ -82,6 +114,103 @@ void RendererGL::keyboard(GLFWwindow* window, int key, int scancode, int action,
          Renderer->Lights->toggleLightSwitch();
          std::cout << "Light Turned " << (Renderer->Lights->isLightOn() ? "On!\n" : "Off!\n");
          break;
+      case GLFW_KEY_C:
+         Renderer->Lights->toggleLightClustering();
+         std::cout << "Light Clustering " << (Renderer->Lights->isLightClusteringOn() ? "On!\n" : "Off!\n");
+         break;
+      case GLFW_KEY_O: {
+         const bool use_dual_paraboloid = !Renderer->Lights->usesDualParaboloidShadow( 0 );
+         Renderer->Lights->setDualParaboloidShadow( 0, use_dual_paraboloid );
+         std::cout << "Point Light Shadow: " << (use_dual_paraboloid ? "Dual-Paraboloid\n" : "Cube Map\n");
+      } break;
+      case GLFW_KEY_EQUAL:
+      case GLFW_KEY_MINUS:
+         Renderer->ShadowScheduler->setBudget(
+            Renderer->ShadowScheduler->getBudget() + (key == GLFW_KEY_EQUAL ? 0.5f : -0.5f)
+         );
+         std::cout << "Shadow Update Budget: " << Renderer->ShadowScheduler->getBudget() << " ms\n";
+         break;
+      case GLFW_KEY_LEFT_BRACKET:
+      case GLFW_KEY_RIGHT_BRACKET:
+         Renderer->setShadowMapQuality(
+            key == GLFW_KEY_RIGHT_BRACKET ? Renderer->ShadowMapSize * 2 : Renderer->ShadowMapSize / 2,
+            Renderer->ShadowDepthFormatIndex
+         );
+         std::cout << "Shadow Map Resolution: " << Renderer->ShadowMapSize << "\n";
+         break;
+      case GLFW_KEY_F: {
+         const int format_index = (Renderer->ShadowDepthFormatIndex + 1) % static_cast<int>(ShadowDepthFormats.size());
+         Renderer->setShadowMapQuality( Renderer->ShadowMapSize, format_index );
+         const std::array<const char*, 3> format_names{ "16-bit", "24-bit", "32-bit Float" };
+         std::cout << "Shadow Map Depth Format: " << format_names[format_index] << "\n";
+      } break;
+      case GLFW_KEY_K:
+         Renderer->PCFKernelSize = Renderer->PCFKernelSize >= 7 ? 1 : Renderer->PCFKernelSize + 2;
+         Renderer->createShadowShaders();
+         std::cout << "PCF Kernel: " << Renderer->PCFKernelSize << "x" << Renderer->PCFKernelSize << "\n";
+         break;
+      case GLFW_KEY_H:
+         Renderer->UseSoftShadows = !Renderer->UseSoftShadows;
+         std::cout << "Soft Shadows " << (Renderer->UseSoftShadows ? "On!\n" : "Off!\n");
+         break;
+      case GLFW_KEY_J:
+         // The sample counts of the soft shadows cycle through 8/16, 16/32, and 32/64.
+         Renderer->BlockerSearchSampleNum = Renderer->BlockerSearchSampleNum >= 32 ? 8 : Renderer->BlockerSearchSampleNum * 2;
+         Renderer->SoftShadowFilterSampleNum = 2 * Renderer->BlockerSearchSampleNum;
+         std::cout << "Soft Shadow Samples: " << Renderer->BlockerSearchSampleNum << " for the blocker search, "
+            << Renderer->SoftShadowFilterSampleNum << " for the filter\n";
+         break;
+      case GLFW_KEY_V: {
+         // Every tile is rendered again, so that all of them have moments from the next frame.
+         const std::array<const char*, 3> filter_names{ "Depth Comparison", "Exponential Variance", "Moment" };
+         const int type = (static_cast<int>(Renderer->MomentShadowType) + 1) % static_cast<int>(filter_names.size());
+         Renderer->MomentShadowType = static_cast<MomentShadowGL::Type>(type);
+         Renderer->createShadowShaders();
+         Renderer->setShadowMapQuality( Renderer->ShadowMapSize, Renderer->ShadowDepthFormatIndex );
+         std::cout << "Spotlight Shadow Filter: " << filter_names[type] << "\n";
+      } break;
+      case GLFW_KEY_B:
+         Renderer->UseReceiverPlaneBias = !Renderer->UseReceiverPlaneBias;
+         std::cout << "Receiver Plane Depth Bias: " << (Renderer->UseReceiverPlaneBias ? "ON\n" : "OFF\n");
+         break;
+      case GLFW_KEY_U:
+         Renderer->CascadedShadow->setWarping( !Renderer->CascadedShadow->isWarping() );
+         std::cout << "Light Space Perspective Warping: " << (Renderer->CascadedShadow->isWarping() ? "ON\n" : "OFF\n");
+         break;
+      case GLFW_KEY_X:
+         Renderer->VirtualShadow->setEnabled( !Renderer->VirtualShadow->isEnabled() );
+         std::cout << "Virtual Shadow Map: " << (Renderer->VirtualShadow->isEnabled() ? "ON\n" : "OFF\n");
+         break;
+      case GLFW_KEY_N:
+         // The statistics are averaged since the last report, so every report covers the frames in between.
+         if (Renderer->VirtualShadow->isEnabled()) {
+            std::cout << "Virtual Shadow Pages: " << std::fixed << std::setprecision( 1 )
+               << 100.0f * Renderer->VirtualShadow->getHitRate() << "% hit rate, "
+               << Renderer->VirtualShadow->getRenderedPagesPerFrame() << " rendered per frame over "
+               << Renderer->VirtualShadow->getFrameNum() << " frames, "
+               << Renderer->VirtualShadow->getResidentPageNum() << " resident\n" << std::defaultfloat;
+            Renderer->VirtualShadow->resetStatistics();
+         }
+         break;
+      case GLFW_KEY_G:
+         Renderer->ContactShadow->setEnabled( !Renderer->ContactShadow->isEnabled() );
+         std::cout << "Contact Shadows: " << (Renderer->ContactShadow->isEnabled() ? "ON\n" : "OFF\n");
+         break;
+      case GLFW_KEY_T:
+         // The step count of the contact shadow rays cycles through 4, 8, 16, and 32.
+         Renderer->ContactShadow->setStepNum(
+            Renderer->ContactShadow->getStepNum() >= 32 ? 4 : Renderer->ContactShadow->getStepNum() * 2
+         );
+         std::cout << "Contact Shadow Steps: " << Renderer->ContactShadow->getStepNum() << "\n";
+         break;
+      case GLFW_KEY_Z:
+         // Every map is rendered again, because the cached depth follows the previous convention.
+         Renderer->UseReversedZ = !Renderer->UseReversedZ;
+         Renderer->setDepthConvention();
+         Renderer->createShadowShaders();
+         Renderer->setShadowMapQuality( Renderer->ShadowMapSize, Renderer->ShadowDepthFormatIndex );
+         std::cout << "Reversed Depth: " << (Renderer->UseReversedZ ? "ON\n" : "OFF\n");
+         break;
       case GLFW_KEY_P: {
          const glm::vec3 pos = Renderer->MainCamera->getCameraPosition();
          std::cout << "Camera Position: " << pos.x << ", " << pos.y << ", " << pos.z << "\n";
@@ -140,6 +269,112 @@ void RendererGL::reshape(GLFWwindow* window, int width, int height)
    glViewport( 0, 0, width, height );
 }
 
+void RendererGL::setDepthConvention() const
+{
+   // The depth is in [0, 1] in NDC for both conventions, so the float depth is not squeezed around the middle
+   // of the range. The reversed depth is 1 at the near plane, so the nearer fragment has the greater depth.
+   glClipControl( GL_LOWER_LEFT, GL_ZERO_TO_ONE );
+   glDepthFunc( UseReversedZ ? GL_GREATER : GL_LESS );
+   glClearDepth( UseReversedZ ? 0.0 : 1.0 );
+   MainCamera->setReversedZ( UseReversedZ );
+   LightCamera->setReversedZ( UseReversedZ );
+}
+
+void RendererGL::createShadowShaders()
+{
+   // The PCF kernel, the shadow filter, and the depth convention are permutations of the shaders, so the loops
+   // of the kernel are unrolled for its size and the unused paths are compiled out.
+   const std::string shader_directory_path = std::string(CMAKE_SOURCE_DIR) + "/shaders";
+   const int reversed_z = UseReversedZ ? 1 : 0;
+   ShadowShader = std::make_unique<ShaderGL>();
+   ShadowShader->setShaderConstant( "PCF_KERNEL_SIZE", 0, PCFKernelSize );
+   ShadowShader->setShaderConstant( "MOMENT_SHADOW", 1, static_cast<int>(MomentShadowType) );
+   ShadowShader->setShaderConstant( "REVERSED_Z", 2, reversed_z );
+   ShadowShader->setShader(
+      std::string(shader_directory_path + "/Shadow.vert").c_str(),
+      std::string(shader_directory_path + "/Shadow.frag").c_str()
+   );
+   ShadowShader->setUniformLocations();
+   ShadowShader->enableHotReload();
+
+   ShadowMomentShader = std::make_unique<ShaderGL>();
+   ShadowMomentShader->setShaderConstant( "MOMENT_SHADOW", 1, std::max( static_cast<int>(MomentShadowType), 1 ) );
+   ShadowMomentShader->setShaderConstant( "REVERSED_Z", 2, reversed_z );
+   ShadowMomentShader->setComputeShaders(
+      std::string(shader_directory_path + "/ShadowMoments.comp").c_str()
+   );
+   ShadowMomentShader->enableHotReload();
+
+   CubeShadowShader = std::make_unique<ShaderGL>();
+   CubeShadowShader->setShaderConstant( "REVERSED_Z", 2, reversed_z );
+   CubeShadowShader->setShader(
+      std::string(shader_directory_path + "/PointShadow.vert").c_str(),
+      std::string(shader_directory_path + "/PointShadow.frag").c_str(),
+      std::string(shader_directory_path + "/PointShadow.geom").c_str()
+   );
+   CubeShadowShader->setBasicUniformLocations();
+   CubeShadowShader->enableHotReload();
+
+   ParaboloidShadowShader = std::make_unique<ShaderGL>();
+   ParaboloidShadowShader->setShaderConstant( "DUAL_PARABOLOID", 3, 1 );
+   ParaboloidShadowShader->setShaderConstant( "REVERSED_Z", 2, reversed_z );
+   ParaboloidShadowShader->setBinaryVariant( "DUAL_PARABOLOID" );
+   ParaboloidShadowShader->setShader(
+      std::string(shader_directory_path + "/PointShadow.vert").c_str(),
+      std::string(shader_directory_path + "/PointShadow.frag").c_str(),
+      std::string(shader_directory_path + "/PointShadow.geom").c_str()
+   );
+   ParaboloidShadowShader->setBasicUniformLocations();
+   ParaboloidShadowShader->enableHotReload();
+
+   CascadedShadowShader = std::make_unique<ShaderGL>();
+   CascadedShadowShader->setShaderConstant( "REVERSED_Z", 2, reversed_z );
+   CascadedShadowShader->setShader(
+      std::string(shader_directory_path + "/PointShadow.vert").c_str(),
+      std::string(shader_directory_path + "/BasicPipeline.frag").c_str(),
+      std::string(shader_directory_path + "/CascadedShadow.geom").c_str()
+   );
+   CascadedShadowShader->setBasicUniformLocations();
+   CascadedShadowShader->enableHotReload();
+}
+
+void RendererGL::setShadowMapQuality(int shadow_map_size, int depth_format_index)
+{
+   // The maps are re-allocated at once, and all their cached depth is rendered again from the next frame.
+   ShadowMapSize = glm::clamp( shadow_map_size, MinShadowMapSize, MaxShadowMapSize );
+   ShadowDepthFormatIndex = depth_format_index;
+   const GLenum depth_format = ShadowDepthFormats[ShadowDepthFormatIndex];
+   ShadowAtlas->recreateAtlas( ShadowMapSize, depth_format, UseReversedZ );
+   PointShadow->recreateShadowMaps( ShadowMapSize / 4, depth_format, UseReversedZ );
+   CascadedShadow->recreateShadowMaps( ShadowMapSize / 2, depth_format, UseReversedZ );
+   MomentShadow->createMomentAtlas( MomentShadowType, ShadowMapSize, ShadowAtlas->getMaxTileSize() );
+   VirtualShadow->recreatePool( depth_format, UseReversedZ );
+}
+
+float RendererGL::getShadowDepthEpsilon() const
+{
+   switch (ShadowDepthFormats[ShadowDepthFormatIndex]) {
+      case GL_DEPTH_COMPONENT16: return 1.0f / 65535.0f;
+      case GL_DEPTH_COMPONENT24: return 1.0f / 16777215.0f;
+      default: return 0.0f;
+   }
+}
+
+void RendererGL::setShadowDepthBias(int light_index, const ShaderGL* point_shadow_shader) const
+{
+   // The polygon offset pushes the casters away from the light, which is toward the depth 0 for the reversed depth.
+   // The point light maps write their depth, so they add the biases in the shader, with the constant bias
+   // in the steps of the depth format.
+   const glm::vec2& bias = Lights->getShadowDepthBias( light_index );
+   if (point_shadow_shader != nullptr) {
+      const float depth_step = std::max( getShadowDepthEpsilon(), 1.0f / 16777216.0f );
+      glUniform2f( point_shadow_shader->getUniformLocation( "DepthBias" ), bias.x, bias.y * depth_step );
+      return;
+   }
+   const float direction = UseReversedZ ? -1.0f : 1.0f;
+   glPolygonOffset( direction * bias.x, direction * bias.y );
+}
+
 void RendererGL::registerCallbacks() const
 {
    glfwSetWindowCloseCallback( Window, cleanup );
@@ -157,6 +392,26 @@ void RendererGL::setLights() const
    const glm::vec4 diffuse_color(0.7f, 0.7f, 0.7f, 1.0f);
    const glm::vec4 specular_color(0.9f, 0.9f, 0.9f, 1.0f);
    Lights->addLight( light_position, ambient_color, diffuse_color, specular_color );
+
+   // The spotlights over the tiger and the panda share the shadow atlas with the light above.
+   const glm::vec4 no_ambient_color(0.0f, 0.0f, 0.0f, 1.0f);
+   const glm::vec3 downward(0.0f, -1.0f, 0.0f);
+   Lights->addLight(
+      glm::vec4(250.0f, 300.0f, 330.0f, 1.0f), no_ambient_color, glm::vec4(0.8f, 0.6f, 0.3f, 1.0f), specular_color,
+      downward, 35.0f, 0.3f, 60.0f
+   );
+   Lights->addLight(
+      glm::vec4(250.0f, 300.0f, 180.0f, 1.0f), no_ambient_color, glm::vec4(0.3f, 0.5f, 0.8f, 1.0f), specular_color,
+      downward, 35.0f, 0.3f, 60.0f
+   );
+
+   // The dim sun covers the whole scene with cascades.
+   Lights->addLight(
+      glm::vec4(1.0f, 2.0f, 1.0f, 0.0f), no_ambient_color, glm::vec4(0.2f, 0.2f, 0.2f, 1.0f), specular_color
+   );
+
+   // The cascade texels are much larger than the atlas texels, so the sun relies more on the slope of its casters.
+   Lights->setShadowBias( Lights->getTotalLightNum() - 1, 4.0f, 1.0f, 1.5f );
 }
 
 void RendererGL::setGroundObject() const
@@ -199,6 +454,8 @@ void RendererGL::setGroundObject() const
       std::string(sample_directory_path + "/sand.jpg")
    );
    GroundObject->setDiffuseReflectionColor( { 1.0f, 1.0f, 1.0f, 1.0f } );
+   GroundObject->setStatic( true );
+   GroundObject->setShadowCaster( false );
 }
 
 void RendererGL::setTigerObject() const
@@ -232,6 +489,13 @@ void RendererGL::setTigerObject() const
       std::string(sample_directory_path + "/Tiger/tiger.jpg")
    );
    TigerObject->setDiffuseReflectionColor( { 1.0f, 1.0f, 1.0f, 1.0f } );
+   TigerObject->setStatic( true );
+   TigerObject->setWorldMatrix(
+      translate( glm::mat4(1.0f), glm::vec3(250.0f, 0.0f, 330.0f) ) *
+      rotate( glm::mat4(1.0f), glm::radians( 180.0f ), glm::vec3(0.0f, 1.0f, 0.0f) ) *
+      rotate( glm::mat4(1.0f), glm::radians( -90.0f ), glm::vec3(1.0f, 0.0f, 0.0f) ) *
+      scale( glm::mat4(1.0f), glm::vec3( 0.3f, 0.3f, 0.3f ) )
+   );
 }
 
 void RendererGL::setPandaObject() const
@@ -243,24 +507,16 @@ void RendererGL::setPandaObject() const
       std::string(sample_directory_path + "/Panda/panda.png")
    );
    PandaObject->setDiffuseReflectionColor( { 1.0f, 1.0f, 1.0f, 1.0f } );
-}
-
-void RendererGL::setDepthFrameBuffer()
-{
-   glCreateTextures( GL_TEXTURE_2D, 1, &DepthTextureID );
-   glTextureStorage2D( DepthTextureID, 1, GL_DEPTH_COMPONENT32F, LightCamera->getWidth(), LightCamera->getHeight() );
-   glTextureParameteri( DepthTextureID, GL_TEXTURE_MIN_FILTER, GL_LINEAR );
-   glTextureParameteri( DepthTextureID, GL_TEXTURE_MAG_FILTER, GL_LINEAR );
-   glTextureParameteri( DepthTextureID, GL_TEXTURE_COMPARE_MODE, GL_COMPARE_REF_TO_TEXTURE );
-   glTextureParameteri( DepthTextureID, GL_TEXTURE_COMPARE_FUNC, GL_LEQUAL );
-
-   glCreateFramebuffers( 1, &FBO );
-   glNamedFramebufferTexture( FBO, GL_DEPTH_ATTACHMENT, DepthTextureID, 0 );
+   PandaObject->setStatic( true );
+   PandaObject->setWorldMatrix(
+      translate( glm::mat4(1.0f), glm::vec3(250.0f, -5.0f, 180.0f) ) *
+      scale( glm::mat4(1.0f), glm::vec3( 20.0f, 20.0f, 20.0f ) )
+   );
 }
 
 void RendererGL::drawGroundObject(ShaderGL* shader, CameraGL* camera) const
 {
-   shader->transferBasicTransformationUniforms( glm::mat4(1.0f), camera, true );
+   shader->transferBasicTransformationUniforms( GroundObject->getWorldMatrix(), camera, true );
    GroundObject->transferUniformsToShader( shader );
 
    glBindTextureUnit( 0, GroundObject->getTextureID( 0 ) );
@@ -270,12 +526,8 @@ void RendererGL::drawGroundObject(ShaderGL* shader, CameraGL* camera) const
 
 void RendererGL::drawTigerObject(ShaderGL* shader, CameraGL* camera) const
 {
-   const glm::mat4 to_world =
-      translate( glm::mat4(1.0f), glm::vec3(250.0f, 0.0f, 330.0f) ) *
-      rotate( glm::mat4(1.0f), glm::radians( 180.0f ), glm::vec3(0.0f, 1.0f, 0.0f) ) *
-      rotate( glm::mat4(1.0f), glm::radians( -90.0f ), glm::vec3(1.0f, 0.0f, 0.0f) ) *
-      scale( glm::mat4(1.0f), glm::vec3( 0.3f, 0.3f, 0.3f ) );
-   shader->transferBasicTransformationUniforms( to_world, camera, true );
+   shader->transferBasicTransformationUniforms( TigerObject->getWorldMatrix(), camera, true );
+   TigerObject->transferUniformsToShader( shader );
 
    glBindTextureUnit( 0, TigerObject->getTextureID( 0 ) );
    glBindVertexArray( TigerObject->getVAO() );
@@ -284,11 +536,7 @@ void RendererGL::drawTigerObject(ShaderGL* shader, CameraGL* camera) const
 
 void RendererGL::drawPandaObject(ShaderGL* shader, CameraGL* camera) const
 {
-   const glm::mat4 to_world =
-      translate(glm::mat4(1.0f), glm::vec3(250.0f, -5.0f, 180.0f) ) *
-      scale(glm::mat4(1.0f), glm::vec3( 20.0f, 20.0f, 20.0f ) );
-   shader->transferBasicTransformationUniforms( to_world, camera, true );
-
+   shader->transferBasicTransformationUniforms( PandaObject->getWorldMatrix(), camera, true );
    PandaObject->transferUniformsToShader( shader );
 
    glBindTextureUnit( 0, PandaObject->getTextureID( 0 ) );
@@ -296,53 +544,486 @@ void RendererGL::drawPandaObject(ShaderGL* shader, CameraGL* camera) const
    glDrawArrays( PandaObject->getDrawMode(), 0, PandaObject->getVertexNum() );
 }
 
-void RendererGL::drawDepthMapFromLightView(int light_index) const
+bool RendererGL::setLightCamera(int light_index) const
+{
+   // Only a spotlight is shadowed through the light camera, and the others have their own shadow maps.
+   if (Lights->getShadowType( light_index ) != LightGL::ShadowType::Spot) return false;
+
+   const LightGL::LightInfo& light = Lights->getLight( light_index );
+   const glm::vec3 light_position = glm::vec3(light.Position) / light.Position.w;
+   const glm::vec3 direction = glm::normalize( light.SpotlightDirection );
+   const glm::vec3 up = std::abs( direction.y ) > 0.99f ? glm::vec3(1.0f, 0.0f, 0.0f) : glm::vec3(0.0f, 1.0f, 0.0f);
+   LightCamera->updateCameraPosition( light_position, light_position + direction, up );
+
+   // The receivers are where the scene, the influence of the light, and the visible part of the view frustum meet.
+   // The casters are anywhere in the scene within the influence.
+   const float influence_radius = LightGL::getInfluenceRadius( light.FallOffRadius );
+   const std::array<glm::vec3, 2> scene_bounds = getSceneBounds();
+   const std::array<glm::vec3, 2> caster_bounds{
+      glm::max( scene_bounds[0], light_position - influence_radius ),
+      glm::min( scene_bounds[1], light_position + influence_radius )
+   };
+   const glm::vec2 visible_depth_range = getVisibleDepthRange();
+   const glm::vec4 visible_sphere = MainCamera->getFrustumSliceBoundingSphere( visible_depth_range.x, visible_depth_range.y );
+   const std::array<glm::vec3, 2> receiver_bounds{
+      glm::max( caster_bounds[0], glm::vec3(visible_sphere) - visible_sphere.w ),
+      glm::min( caster_bounds[1], glm::vec3(visible_sphere) + visible_sphere.w )
+   };
+
+   // The depth and the tangent are linear and quasi-linear in the view space of the light, so their extremes
+   // over a box are at its corners. A box reaching behind the light keeps the whole cone.
+   float fov = 2.0f * light.SpotlightCutoffAngle;
+   float near_plane = 1.0f, far_plane = influence_radius;
+   const glm::mat4& light_view = LightCamera->getViewMatrix();
+   const auto getCorner = [](const std::array<glm::vec3, 2>& bounds, int i) {
+      return glm::vec3(bounds[i & 1].x, bounds[(i >> 1) & 1].y, bounds[(i >> 2) & 1].z);
+   };
+   if (glm::all( glm::lessThanEqual( receiver_bounds[0], receiver_bounds[1] ) )) {
+      bool reaches_behind = false;
+      float max_tangent = 0.0f, max_depth = 0.0f;
+      for (int i = 0; i < 8; ++i) {
+         const glm::vec3 corner = glm::vec3(light_view * glm::vec4(getCorner( receiver_bounds, i ), 1.0f));
+         const float depth = -corner.z;
+         if (depth <= near_plane) reaches_behind = true;
+         else max_tangent = std::max( max_tangent, std::max( std::abs( corner.x ), std::abs( corner.y ) ) / depth );
+         max_depth = std::max( max_depth, depth );
+      }
+      if (!reaches_behind) fov = std::min( fov, 2.0f * glm::degrees( std::atan( max_tangent ) ) );
+      far_plane = std::min( far_plane, max_depth );
+
+      float min_depth = far_plane;
+      for (int i = 0; i < 8; ++i) {
+         min_depth = std::min( min_depth, -(light_view * glm::vec4(getCorner( caster_bounds, i ), 1.0f)).z );
+      }
+      near_plane = std::max( near_plane, min_depth );
+   }
+
+   // The fitted frustum moves in coarse steps, so that the cached depth is not invalidated by every small move
+   // of the main camera.
+   const float depth_step = influence_radius / 16.0f;
+   fov = std::min( std::ceil( fov / ShadowFovStep ) * ShadowFovStep, 2.0f * light.SpotlightCutoffAngle );
+   far_plane = glm::clamp( std::ceil( far_plane / depth_step ) * depth_step, depth_step, influence_radius );
+   near_plane = std::max( std::min( std::floor( near_plane / depth_step ) * depth_step, far_plane - depth_step ), 1.0f );
+   LightCamera->updateProjection( fov, 1.0f, near_plane, far_plane );
+   return true;
+}
+
+std::array<glm::vec3, 2> RendererGL::getSceneBounds() const
+{
+   std::array<glm::vec3, 2> bounds{ glm::vec3(std::numeric_limits<float>::max()), glm::vec3(std::numeric_limits<float>::lowest()) };
+   for (const auto* object : { TigerObject.get(), PandaObject.get(), GroundObject.get() }) {
+      const glm::vec4 sphere = object->getBoundingSphereInWorld();
+      bounds[0] = glm::min( bounds[0], glm::vec3(sphere) - sphere.w );
+      bounds[1] = glm::max( bounds[1], glm::vec3(sphere) + sphere.w );
+   }
+   return bounds;
+}
+
+glm::vec2 RendererGL::getVisibleDepthRange() const
+{
+   // Until the first bounds are read back, the whole view frustum is assumed to be visible.
+   if (!DepthBounds->hasBounds()) return { MainCamera->getNearPlane(), MainCamera->getFarPlane() };
+
+   const glm::vec2& range = DepthBounds->getVisibleDepthRange();
+   return {
+      std::max( range.x, MainCamera->getNearPlane() ),
+      std::max( std::min( range.y, MainCamera->getFarPlane() ), MainCamera->getNearPlane() )
+   };
+}
+
+void RendererGL::allocateShadowTiles() const
 {
-   glBindFramebuffer( GL_FRAMEBUFFER, FBO );
-   glClearDepth( 1.0f );
-   glClear( GL_DEPTH_BUFFER_BIT );
+   std::vector<ShadowAtlasGL::TileRequest> requests;
+   for (int i = 0; i < Lights->getTotalLightNum(); ++i) {
+      if (!setLightCamera( i )) continue;
 
-   glUseProgram( ObjectShader->getShaderProgram() );
+      // The tile resolution follows how much of the screen the light can reach.
+      requests.emplace_back(
+         i,
+         ShadowAtlas->getTileSize( getShadowImportance( i ) ),
+         LightCamera->getProjectionMatrix() * LightCamera->getViewMatrix()
+      );
+   }
+   ShadowAtlas->allocateTiles( requests, Lights->getTotalLightNum() );
+}
 
-   LightCamera->updateCameraPosition(
-      glm::vec3(Lights->getLightPosition( light_index )),
-      glm::vec3(256.0f, 0.0f, 10.0f),
-      glm::vec3(0.0f, 1.0f, 0.0f)
+float RendererGL::getShadowImportance(int light_index) const
+{
+   const LightGL::LightInfo& light = Lights->getLight( light_index );
+   return ShadowAtlasGL::getScreenCoverage(
+      glm::vec3(light.Position) / light.Position.w,
+      LightGL::getInfluenceRadius( light.FallOffRadius ),
+      MainCamera.get()
    );
+}
+
+std::vector<bool> RendererGL::scheduleShadowUpdates() const
+{
+   const int light_num = Lights->getTotalLightNum();
+   ShadowScheduler->resize( light_num );
+
+   const bool static_casters_dirty = areStaticCastersDirty();
+   const bool dynamic_casters_exist = hasDynamicCasters();
+   std::vector<ShadowSchedulerGL::Candidate> candidates;
+   for (int i = 0; i < light_num; ++i) {
+      bool map_changed, projection_changed = false;
+      if (ShadowAtlas->hasTile( i )) {
+         map_changed = ShadowAtlas->isTileChanged( i );
+         projection_changed = ShadowAtlas->isProjectionChanged( i );
+      }
+      else if (PointShadow->getShadowType( i ) != LightGL::ShadowType::None) {
+         map_changed = PointShadow->isLayerChanged( i );
+         projection_changed = PointShadow->isDepthRangeChanged( i );
+      }
+      else continue;
+
+      // The static layer stays pending until the light is refreshed, even if the light is skipped for a while.
+      const bool is_moving = Lights->isShadowDirty( i ) || projection_changed;
+      if (map_changed || static_casters_dirty || is_moving) ShadowScheduler->invalidate( i );
+      if (!ShadowScheduler->isStaticPending( i ) && !dynamic_casters_exist) continue;
+
+      candidates.emplace_back( i, getShadowImportance( i ), is_moving, map_changed );
+   }
+
+   std::vector<bool> refreshing(light_num, false);
+   for (const auto& light_index : ShadowScheduler->schedule( candidates )) refreshing[light_index] = true;
+   return refreshing;
+}
+
+bool RendererGL::areStaticCastersDirty() const
+{
+   return (TigerObject->isStatic() && TigerObject->isDirty()) ||
+      (PandaObject->isStatic() && PandaObject->isDirty()) ||
+      (GroundObject->isStatic() && GroundObject->isDirty());
+}
+
+bool RendererGL::hasDynamicCasters() const
+{
+   return !TigerObject->isStatic() || !PandaObject->isStatic() || !GroundObject->isStatic();
+}
 
-   drawTigerObject( ObjectShader.get(), LightCamera.get() );
-   drawPandaObject( ObjectShader.get(), LightCamera.get() );
-   drawGroundObject( ObjectShader.get(), LightCamera.get() );
+std::array<glm::vec3, 2> RendererGL::getReceiverBounds(bool visible_only) const
+{
+   // The visible receivers are clipped to the box of the visible part of the view frustum.
+   // The bounds are empty, the minimum above the maximum, if no receiver is left.
+   std::array<glm::vec3, 2> visible_bounds{ glm::vec3(std::numeric_limits<float>::lowest()), glm::vec3(std::numeric_limits<float>::max()) };
+   if (visible_only) {
+      const glm::vec2 visible_depth_range = getVisibleDepthRange();
+      visible_bounds = { glm::vec3(std::numeric_limits<float>::max()), glm::vec3(std::numeric_limits<float>::lowest()) };
+      for (const auto& corner : MainCamera->getFrustumSliceCorners( visible_depth_range.x, visible_depth_range.y )) {
+         visible_bounds[0] = glm::min( visible_bounds[0], corner );
+         visible_bounds[1] = glm::max( visible_bounds[1], corner );
+      }
+   }
+
+   std::array<glm::vec3, 2> bounds{ glm::vec3(std::numeric_limits<float>::max()), glm::vec3(std::numeric_limits<float>::lowest()) };
+   for (const auto* object : { TigerObject.get(), PandaObject.get(), GroundObject.get() }) {
+      if (!object->isShadowReceiver()) continue;
+
+      const glm::vec4 sphere = object->getBoundingSphereInWorld();
+      const glm::vec3 min_point = glm::max( glm::vec3(sphere) - sphere.w, visible_bounds[0] );
+      const glm::vec3 max_point = glm::min( glm::vec3(sphere) + sphere.w, visible_bounds[1] );
+      if (glm::any( glm::greaterThan( min_point, max_point ) )) continue;
+
+      bounds[0] = glm::min( bounds[0], min_point );
+      bounds[1] = glm::max( bounds[1], max_point );
+   }
+   return bounds;
+}
+
+bool RendererGL::overlapsExtrudedReceivers(
+   const glm::vec4& caster_sphere,
+   const glm::mat4& light_view_projection,
+   const std::array<glm::vec3, 2>& receiver_bounds,
+   bool reversed_z
+)
+{
+   // The light rays are parallel in the clip space of the light, so the receivers extruded toward the light cover
+   // their own rectangle across the light, from the farthest receiver depth up to the light. A box which reaches
+   // behind a perspective light cannot be bounded there, so the caster is kept.
+   const auto getProjectedBounds = [&light_view_projection](const std::array<glm::vec3, 2>& bounds, glm::vec3& min_point, glm::vec3& max_point) {
+      min_point = glm::vec3(std::numeric_limits<float>::max());
+      max_point = glm::vec3(std::numeric_limits<float>::lowest());
+      for (int i = 0; i < 8; ++i) {
+         const glm::vec3 corner(bounds[i & 1].x, bounds[(i >> 1) & 1].y, bounds[(i >> 2) & 1].z);
+         const glm::vec4 point = light_view_projection * glm::vec4(corner, 1.0f);
+         if (point.w <= 0.0f) return false;
+
+         min_point = glm::min( min_point, glm::vec3(point) / point.w );
+         max_point = glm::max( max_point, glm::vec3(point) / point.w );
+      }
+      return true;
+   };
+   const std::array<glm::vec3, 2> caster_bounds{
+      glm::vec3(caster_sphere) - caster_sphere.w, glm::vec3(caster_sphere) + caster_sphere.w
+   };
+   glm::vec3 receiver_min, receiver_max, caster_min, caster_max;
+   if (!getProjectedBounds( receiver_bounds, receiver_min, receiver_max ) ||
+       !getProjectedBounds( caster_bounds, caster_min, caster_max )) return true;
+
+   // Only the receivers inside the light frustum can be shadowed through its map.
+   receiver_min = glm::vec3(glm::max( glm::vec2(receiver_min), glm::vec2(-1.0f) ), receiver_min.z);
+   receiver_max = glm::vec3(glm::min( glm::vec2(receiver_max), glm::vec2(1.0f) ), receiver_max.z);
+   if (caster_max.x < receiver_min.x || caster_min.x > receiver_max.x) return false;
+   if (caster_max.y < receiver_min.y || caster_min.y > receiver_max.y) return false;
+
+   // The caster should be nearer to the light than the farthest receiver, which is toward the depth 1 for the reversed depth.
+   return reversed_z ? caster_max.z >= receiver_min.z : caster_min.z <= receiver_max.z;
+}
+
+bool RendererGL::overlapsReceiverCone(
+   const glm::vec4& caster_sphere,
+   const glm::vec3& light_position,
+   const std::array<glm::vec3, 2>& receiver_bounds
+)
+{
+   // The receivers extruded toward a point light are bounded by the cone from the light around their bounding sphere,
+   // which is cut at the far side of the sphere. A light inside the receivers or the caster keeps the caster.
+   const glm::vec3 receiver_center = 0.5f * (receiver_bounds[0] + receiver_bounds[1]);
+   const float receiver_radius = 0.5f * glm::length( receiver_bounds[1] - receiver_bounds[0] );
+   const glm::vec3 to_receivers = receiver_center - light_position;
+   const glm::vec3 to_caster = glm::vec3(caster_sphere) - light_position;
+   const float receiver_distance = glm::length( to_receivers );
+   const float caster_distance = glm::length( to_caster );
+   if (receiver_distance <= receiver_radius || caster_distance <= caster_sphere.w) return true;
+   if (caster_distance - caster_sphere.w > receiver_distance + receiver_radius) return false;
+
+   const float cone_angle = std::asin( receiver_radius / receiver_distance );
+   const float caster_angle = std::asin( caster_sphere.w / caster_distance );
+   const float angle = std::acos( glm::clamp( glm::dot( to_receivers / receiver_distance, to_caster / caster_distance ), -1.0f, 1.0f ) );
+   return angle <= cone_angle + caster_angle;
+}
+
+bool RendererGL::isCasterNeeded(const ObjectGL* caster, const CasterCullingVolume& volume) const
+{
+   if (!caster->isShadowCaster()) return false;
+   if (glm::any( glm::greaterThan( volume.ReceiverBounds[0], volume.ReceiverBounds[1] ) )) return false;
+
+   const glm::vec4 sphere = caster->getBoundingSphereInWorld();
+   if (volume.LightViewProjections.empty()) return overlapsReceiverCone( sphere, volume.LightPosition, volume.ReceiverBounds );
+   return std::any_of(
+      volume.LightViewProjections.begin(), volume.LightViewProjections.end(),
+      [&](const glm::mat4& view_projection) {
+         return overlapsExtrudedReceivers( sphere, view_projection, volume.ReceiverBounds, UseReversedZ );
+      }
+   );
+}
+
+void RendererGL::drawCasters(ShaderGL* shader, CameraGL* camera, bool static_casters, const CasterCullingVolume& volume) const
+{
+   // Only the casters whose shadows can land on the receivers of the volume are rendered into the map.
+   if (TigerObject->isStatic() == static_casters && isCasterNeeded( TigerObject.get(), volume )) drawTigerObject( shader, camera );
+   if (PandaObject->isStatic() == static_casters && isCasterNeeded( PandaObject.get(), volume )) drawPandaObject( shader, camera );
+   if (GroundObject->isStatic() == static_casters && isCasterNeeded( GroundObject.get(), volume )) drawGroundObject( shader, camera );
+}
+
+void RendererGL::drawShadowAtlas(const std::vector<bool>& refreshing) const
+{
+   // The static casters are rendered into the static atlas only when their shadow is invalidated,
+   // and the dynamic casters are drawn over a copy of it whenever the light is refreshed.
+   // The moments are prefiltered once per update, so the lit pass only fetches them.
+   // The cached static casters are culled by all the receivers, so that the cache stays valid while the view moves,
+   // and the dynamic casters only by the visible ones.
+   const std::array<glm::vec3, 2> receiver_bounds = getReceiverBounds( false );
+   const std::array<glm::vec3, 2> visible_receiver_bounds = getReceiverBounds( true );
+   bool moments_updated = false;
+   for (int i = 0; i < Lights->getTotalLightNum(); ++i) {
+      if (!refreshing[i] || !ShadowAtlas->hasTile( i ) || !setLightCamera( i )) continue;
+
+      const std::vector<glm::mat4> light_view_projection{ LightCamera->getProjectionMatrix() * LightCamera->getViewMatrix() };
+
+      glUseProgram( ObjectShader->getShaderProgram() );
+      ShadowScheduler->beginUpdate( i );
+      ShadowAtlas->setLightProjection( i, LightCamera.get() );
+      setShadowDepthBias( i );
+      glEnable( GL_POLYGON_OFFSET_FILL );
+      const glm::ivec4& tile = ShadowAtlas->getTile( i );
+      glViewport( tile.x, tile.y, tile.z, tile.w );
+      if (ShadowScheduler->isStaticPending( i )) {
+         ShadowAtlas->clearStaticTile( i );
+         glBindFramebuffer( GL_FRAMEBUFFER, ShadowAtlas->getStaticFramebuffer() );
+         drawCasters( ObjectShader.get(), LightCamera.get(), true, { receiver_bounds, light_view_projection } );
+      }
+      ShadowAtlas->copyStaticTile( i );
+      glBindFramebuffer( GL_FRAMEBUFFER, ShadowAtlas->getFramebuffer() );
+      drawCasters( ObjectShader.get(), LightCamera.get(), false, { visible_receiver_bounds, light_view_projection } );
+      glDisable( GL_POLYGON_OFFSET_FILL );
+      if (MomentShadow->getType() != MomentShadowGL::Type::None) {
+         MomentShadow->updateTile( ShadowMomentShader.get(), ShadowAtlas.get(), i );
+         moments_updated = true;
+      }
+      ShadowScheduler->endUpdate();
+   }
+   if (moments_updated) MomentShadow->generateMipmaps();
 
    glBindFramebuffer( GL_FRAMEBUFFER, 0 );
+   glViewport( 0, 0, MainCamera->getWidth(), MainCamera->getHeight() );
 }
 
-void RendererGL::drawShadow(int light_index) const
+void RendererGL::drawPointShadowMaps(LightGL::ShadowType shadow_type, ShaderGL* shader, const std::vector<bool>& refreshing) const
 {
-   glUseProgram( ShadowShader->getShaderProgram() );
+   // The geometry shader routes every triangle to the layers of the light, so each light takes one scene pass
+   // for the static casters when they are invalidated, and one for the dynamic casters.
+   glViewport( 0, 0, PointShadow->getMapSize(), PointShadow->getMapSize() );
+   glUseProgram( shader->getShaderProgram() );
+   if (shadow_type == LightGL::ShadowType::DualParaboloid) glEnable( GL_CLIP_DISTANCE0 );
+   const std::array<glm::vec3, 2> receiver_bounds = getReceiverBounds( false );
+   const std::array<glm::vec3, 2> visible_receiver_bounds = getReceiverBounds( true );
+   for (int i = 0; i < Lights->getTotalLightNum(); ++i) {
+      if (!refreshing[i] || PointShadow->getShadowType( i ) != shadow_type) continue;
 
-   Lights->transferUniformsToShader( ShadowShader.get() );
-   glUniform1i( ShadowShader->getLocation( "LightIndex" ), light_index );
+      const glm::vec4 light_position = Lights->getLightPosition( i );
+      const glm::vec3 position = glm::vec3(light_position) / light_position.w;
+
+      ShadowScheduler->beginUpdate( i );
+      PointShadow->updateShadowProjection( i, Lights.get() );
+      PointShadow->transferLightUniformsToShader( shader, i );
+      setShadowDepthBias( i, shader );
+      if (ShadowScheduler->isStaticPending( i )) {
+         PointShadow->clearStaticLayers( i );
+         glBindFramebuffer( GL_FRAMEBUFFER, PointShadow->getFramebuffer( shadow_type, true ) );
+         drawCasters( shader, LightCamera.get(), true, { receiver_bounds, position } );
+      }
+      PointShadow->copyStaticLayers( i );
+      glBindFramebuffer( GL_FRAMEBUFFER, PointShadow->getFramebuffer( shadow_type, false ) );
+      drawCasters( shader, LightCamera.get(), false, { visible_receiver_bounds, position } );
+      ShadowScheduler->endUpdate();
+   }
+   glDisable( GL_CLIP_DISTANCE0 );
 
-   const glm::mat4& view_projection = LightCamera->getProjectionMatrix() * LightCamera->getViewMatrix();
-   glUniformMatrix4fv( ShadowShader->getLocation( "LightViewProjectionMatrix" ), 1, GL_FALSE, &view_projection[0][0] );
+   glBindFramebuffer( GL_FRAMEBUFFER, 0 );
+   glViewport( 0, 0, MainCamera->getWidth(), MainCamera->getHeight() );
+}
+
+void RendererGL::drawCascadedShadowMaps() const
+{
+   // The cascades follow the main camera, so they are redrawn every frame instead of being cached or scheduled.
+   // The depth clamp keeps the casters behind the near plane of a cascade.
+   glViewport( 0, 0, CascadedShadow->getMapSize(), CascadedShadow->getMapSize() );
+   glBindFramebuffer( GL_FRAMEBUFFER, CascadedShadow->getFramebuffer() );
+   glClear( OPENGL_DEPTH_BUFFER_BIT );
+   glUseProgram( CascadedShadowShader->getShaderProgram() );
+   glEnable( GL_DEPTH_CLAMP );
+   glEnable( GL_POLYGON_OFFSET_FILL );
+   const std::array<glm::vec3, 2> visible_receiver_bounds = getReceiverBounds( true );
+   for (int i = 0; i < Lights->getTotalLightNum(); ++i) {
+      if (!CascadedShadow->hasCascades( i )) continue;
+
+      // A caster is drawn once for all the cascades, so it is kept if it shadows the visible receivers of any of them.
+      const glm::mat4* view_projections = CascadedShadow->getViewProjectionMatrices( i );
+      const CasterCullingVolume volume(
+         visible_receiver_bounds,
+         std::vector<glm::mat4>(view_projections, view_projections + CascadedShadowGL::CascadeNum)
+      );
+      CascadedShadow->transferLightUniformsToShader( CascadedShadowShader.get(), i );
+      setShadowDepthBias( i );
+      drawCasters( CascadedShadowShader.get(), LightCamera.get(), true, volume );
+      drawCasters( CascadedShadowShader.get(), LightCamera.get(), false, volume );
+   }
+   glDisable( GL_POLYGON_OFFSET_FILL );
+   glDisable( GL_DEPTH_CLAMP );
 
-   glBindTextureUnit( 1, DepthTextureID );
+   glBindFramebuffer( GL_FRAMEBUFFER, 0 );
+   glViewport( 0, 0, MainCamera->getWidth(), MainCamera->getHeight() );
+}
+
+void RendererGL::drawVirtualShadowPages() const
+{
+   // Only the pages which the visible receivers requested and which are not cached yet are rendered,
+   // a batch of them per pass of the casters.
+   VirtualShadow->updatePages( Lights.get(), getSceneBounds(), { TigerObject.get(), PandaObject.get(), GroundObject.get() } );
+   if (VirtualShadow->getPageBatchNum() > 0) {
+      glBindFramebuffer( GL_FRAMEBUFFER, VirtualShadow->getFramebuffer() );
+      glUseProgram( VirtualShadowShader->getShaderProgram() );
+      setShadowDepthBias( VirtualShadow->getLightIndex() );
+      glEnable( GL_POLYGON_OFFSET_FILL );
+
+      // The pages are cached while the view moves, so the casters are culled by all the receivers.
+      const CasterCullingVolume volume( getReceiverBounds( false ), { VirtualShadow->getViewProjectionMatrix() } );
+      for (int batch = 0; batch < VirtualShadow->getPageBatchNum(); ++batch) {
+         VirtualShadow->transferPageUniformsToShader( VirtualShadowShader.get(), batch );
+         drawCasters( VirtualShadowShader.get(), LightCamera.get(), true, volume );
+         drawCasters( VirtualShadowShader.get(), LightCamera.get(), false, volume );
+      }
+      glDisable( GL_POLYGON_OFFSET_FILL );
+
+      glBindFramebuffer( GL_FRAMEBUFFER, 0 );
+      glViewport( 0, 0, MainCamera->getWidth(), MainCamera->getHeight() );
+   }
+   VirtualShadow->uploadPageTable();
+}
+
+void RendererGL::drawShadow() const
+{
+   // The rays are marched over the depth of the previous frame, which is still in the main target,
+   // and the lit pass reprojects the factors, so the scene is drawn to the main view only once.
+   if (ContactShadow->isEnabled() && ContactShadow->hasDepthView()) {
+      ContactShadow->march( ContactShadowShader.get(), DepthBounds->getDepthTextureID(), Lights.get() );
+   }
+
+   glBindFramebuffer( GL_FRAMEBUFFER, DepthBounds->getFramebuffer() );
+   glClear( OPENGL_COLOR_BUFFER_BIT | OPENGL_DEPTH_BUFFER_BIT );
+   glUseProgram( ShadowShader->getShaderProgram() );
+
+   Lights->transferUniformsToShader( ShadowShader.get() );
+   ShadowAtlas->transferUniformsToShader( ShadowShader.get() );
+   PointShadow->transferUniformsToShader( ShadowShader.get() );
+   CascadedShadow->transferUniformsToShader( ShadowShader.get() );
+   MomentShadow->transferUniformsToShader( ShadowShader.get() );
+   VirtualShadow->transferUniformsToShader( ShadowShader.get() );
+   ContactShadow->transferUniformsToShader( ShadowShader.get() );
+   glUniform1f( ShadowShader->getUniformLocation( "ShadowDepthEpsilon" ), getShadowDepthEpsilon() );
+   glUniform1i( ShadowShader->getUniformLocation( "UseSoftShadows" ), UseSoftShadows ? 1 : 0 );
+   glUniform1i( ShadowShader->getUniformLocation( "BlockerSearchSampleNum" ), BlockerSearchSampleNum );
+   glUniform1i( ShadowShader->getUniformLocation( "SoftShadowFilterSampleNum" ), SoftShadowFilterSampleNum );
+   glUniform1f( ShadowShader->getUniformLocation( "LightSize" ), LightSize );
+   glUniform1i( ShadowShader->getUniformLocation( "UseReceiverPlaneBias" ), UseReceiverPlaneBias ? 1 : 0 );
    drawTigerObject( ShadowShader.get(), MainCamera.get() );
    drawPandaObject( ShadowShader.get(), MainCamera.get() );
    drawGroundObject( ShadowShader.get(), MainCamera.get() );
+   glBindFramebuffer( GL_FRAMEBUFFER, 0 );
+   ContactShadow->setDepthView( MainCamera.get() );
+
+   // The visible depth of this frame fits the shadows of the following frames.
+   DepthBounds->reduce( DepthBoundsShader.get(), MainCamera.get() );
+   if (VirtualShadow->isEnabled()) {
+      VirtualShadow->markPages( PageMarkingShader.get(), DepthBounds->getDepthTextureID(), MainCamera.get() );
+   }
+   DepthBounds->blitToScreen();
 }
 
 void RendererGL::render() const
 {
-   glClear( OPENGL_COLOR_BUFFER_BIT | OPENGL_DEPTH_BUFFER_BIT );
+   DepthBounds->resize( MainCamera->getWidth(), MainCamera->getHeight() );
+   ContactShadow->resize( MainCamera->getWidth(), MainCamera->getHeight() );
+   DepthBounds->collectBounds();
+   if (VirtualShadow->isEnabled()) VirtualShadow->collectRequests();
 
    const float light_x = 1024.0f * cosf( LightTheta ) + 256.0f;
    const float light_z = 1024.0f * sinf( LightTheta ) + 256.0f;
    Lights->setLightPosition( glm::vec4(light_x, 200.0f, light_z, 1.0f), 0 );
+   Lights->updateLightBuffer();
+   Lights->buildLightClusters( LightClusteringShader.get(), MainCamera.get() );
+   Lights->cullLights( { TigerObject.get(), PandaObject.get(), GroundObject.get() } );
+
+   ShadowScheduler->collectTimings();
+   allocateShadowTiles();
+   PointShadow->assignLayers( Lights.get(), getSceneBounds() );
+   const std::vector<bool> refreshing = scheduleShadowUpdates();
+   drawShadowAtlas( refreshing );
+   drawPointShadowMaps( LightGL::ShadowType::CubeMap, CubeShadowShader.get(), refreshing );
+   drawPointShadowMaps( LightGL::ShadowType::DualParaboloid, ParaboloidShadowShader.get(), refreshing );
+   CascadedShadow->updateCascades( Lights.get(), MainCamera.get(), getVisibleDepthRange(), getSceneBounds() );
+   drawCascadedShadowMaps();
+   if (VirtualShadow->isEnabled()) drawVirtualShadowPages();
+   ShadowAtlas->uploadShadowBuffer();
+   PointShadow->uploadShadowBuffer();
+   Lights->clearShadowDirty();
+   TigerObject->clearDirty();
+   PandaObject->clearDirty();
+   GroundObject->clearDirty();
 
-   drawDepthMapFromLightView( 0 );
-   drawShadow( 0 );
+   drawShadow();
 
    glBindVertexArray( 0 );
    glUseProgram( 0 );
@@ -356,14 +1037,22 @@ void RendererGL::play()
    setGroundObject();
    setTigerObject();
    setPandaObject();
-   setDepthFrameBuffer();
+   setShadowMapQuality( ShadowMapSize, ShadowDepthFormatIndex );
 
    ObjectShader->setBasicUniformLocations();
-   ShadowShader->setUniformLocations( 1 );
-   ShadowShader->addUniformLocation( "LightIndex" );
-   ShadowShader->addUniformLocation( "LightViewProjectionMatrix" );
 
    while (!glfwWindowShouldClose( Window )) {
+      ObjectShader->updateHotReload();
+      ShadowShader->updateHotReload();
+      LightClusteringShader->updateHotReload();
+      CubeShadowShader->updateHotReload();
+      ParaboloidShadowShader->updateHotReload();
+      CascadedShadowShader->updateHotReload();
+      DepthBoundsShader->updateHotReload();
+      ShadowMomentShader->updateHotReload();
+      VirtualShadowShader->updateHotReload();
+      PageMarkingShader->updateHotReload();
+      ContactShadowShader->updateHotReload();
       render();
 
       LightTheta += 0.01f;
@@ -1,11 +1,27 @@
 #include "shader.h"
 
-ShaderGL::ShaderGL() : ShaderProgram( 0 )
+#ifdef __linux__
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
+#ifndef GL_COMPLETION_STATUS_KHR
+#define GL_COMPLETION_STATUS_KHR 0x91B1
+#endif
+
+ShaderGL::ShaderGL() :
+   LoadedFromBinaries( false ), ReloadRequested( false ), ParallelCompileSupported( false ), WatchDescriptor( -1 ),
+   UsesMaterialLocations( false ), ShaderProgram( 0 ), PendingProgram( 0 )
 {
 }
 
 ShaderGL::~ShaderGL()
 {
+#ifdef __linux__
+   if (WatchDescriptor >= 0) close( WatchDescriptor );
+#endif
+   if (PendingProgram != 0) glDeleteProgram( PendingProgram );
+   for (const auto& shader : PendingShaders) glDeleteShader( shader.second );
    if (ShaderProgram != 0) glDeleteProgram( ShaderProgram );
 }
 
@@ -57,12 +73,26 @@ bool ShaderGL::checkCompileError(GLenum shader_type, const GLuint& shader)
    return compiled == GL_TRUE;
 }
 
-GLuint ShaderGL::getCompiledShader(GLenum shader_type, const char* shader_path)
+void ShaderGL::insertShaderConstants(std::string& shader_contents) const
 {
-   if (shader_path == nullptr) return 0;
+   if (ShaderConstants.empty()) return;
 
+   std::string defines;
+   for (const auto& constant : ShaderConstants) {
+      defines += "#define " + constant.first + " " + std::to_string( constant.second.Value ) + "\n";
+   }
+
+   // The defines should follow the #version directive, which has to be the first statement.
+   const size_t version = shader_contents.find( "#version" );
+   const size_t position = version == std::string::npos ? 0 : shader_contents.find( '\n', version ) + 1;
+   shader_contents.insert( position, defines );
+}
+
+GLuint ShaderGL::getCompiledShader(GLenum shader_type, const std::string& shader_path) const
+{
    std::string shader_contents;
-   readShaderFile( shader_contents, shader_path );
+   readShaderFile( shader_contents, shader_path.c_str() );
+   insertShaderConstants( shader_contents );
 
    const GLuint shader = glCreateShader( shader_type );
    const char* shader_source = shader_contents.c_str();
@@ -75,6 +105,235 @@ GLuint ShaderGL::getCompiledShader(GLenum shader_type, const char* shader_path)
    return shader;
 }
 
+std::string ShaderGL::getBinaryPath(
+   [[maybe_unused]] const std::string& shader_path,
+   [[maybe_unused]] const std::string& variant
+)
+{
+#ifdef SPIRV_SHADER_DIRECTORY
+   const size_t slash = shader_path.find_last_of( "/\\" );
+   const std::string file_name = slash == std::string::npos ? shader_path : shader_path.substr( slash + 1 );
+   return std::string(SPIRV_SHADER_DIRECTORY) + "/" + file_name + (variant.empty() ? "" : "." + variant) + ".spv";
+#else
+   return {};
+#endif
+}
+
+std::vector<GLuint> ShaderGL::getSpecializationConstantIDs(const std::vector<char>& binary)
+{
+   // The module is a stream of 32-bit words after the 5-word header. Each instruction starts with a word of
+   // its word count in the high 16 bits and its opcode in the low 16 bits.
+   constexpr uint32_t decorate_opcode = 71;
+   constexpr uint32_t spec_id_decoration = 1;
+   std::vector<uint32_t> words(binary.size() / sizeof( uint32_t ));
+   std::memcpy( words.data(), binary.data(), words.size() * sizeof( uint32_t ) );
+
+   std::vector<GLuint> ids;
+   for (size_t i = 5; i < words.size();) {
+      const uint32_t word_num = words[i] >> 16;
+      if (word_num == 0 || i + word_num > words.size()) break;
+
+      // OpDecorate %target SpecId <id>
+      if ((words[i] & 0xFFFFu) == decorate_opcode && word_num == 4 && words[i + 2] == spec_id_decoration) {
+         ids.emplace_back( static_cast<GLuint>(words[i + 3]) );
+      }
+      i += word_num;
+   }
+   return ids;
+}
+
+GLuint ShaderGL::getSpecializedShader(GLenum shader_type, const std::string& shader_path) const
+{
+   if (!GLAD_GL_VERSION_4_6) return 0;
+
+   std::string binary_path = getBinaryPath( shader_path, BinaryVariant );
+   if (binary_path.empty()) return 0;
+
+   // Only the stages whose layout depends on the variant have a binary of it, and the others share the common one.
+   std::ifstream file( binary_path, std::ios::in | std::ios::binary );
+   if (!file.is_open() && !BinaryVariant.empty()) {
+      binary_path = getBinaryPath( shader_path, "" );
+      file.open( binary_path, std::ios::in | std::ios::binary );
+   }
+   if (!file.is_open()) return 0;
+
+   const std::vector<char> binary((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+   file.close();
+   if (binary.empty()) return 0;
+
+   // The specialization fails if a constant is not declared in the module, so each stage only gets its own constants.
+   const std::vector<GLuint> declared_ids = getSpecializationConstantIDs( binary );
+   std::vector<GLuint> constant_indices, constant_values;
+   for (const auto& constant : ShaderConstants) {
+      if (std::find( declared_ids.begin(), declared_ids.end(), constant.second.ID ) == declared_ids.end()) continue;
+      constant_indices.emplace_back( constant.second.ID );
+      constant_values.emplace_back( static_cast<GLuint>(constant.second.Value) );
+   }
+
+   const GLuint shader = glCreateShader( shader_type );
+   glShaderBinary( 1, &shader, GL_SHADER_BINARY_FORMAT_SPIR_V, binary.data(), static_cast<GLsizei>(binary.size()) );
+   glSpecializeShader(
+      shader, "main",
+      static_cast<GLuint>(constant_indices.size()), constant_indices.data(), constant_values.data()
+   );
+   if (!checkCompileError( shader_type, shader )) {
+      std::cerr << "Could not specialize shader binary " << binary_path << "\n";
+      return 0;
+   }
+   return shader;
+}
+
+bool ShaderGL::checkLinkError(const GLuint& program)
+{
+   GLint linked = 0;
+   glGetProgramiv( program, GL_LINK_STATUS, &linked );
+
+   if (linked == GL_FALSE) {
+      GLint max_length = 0;
+      glGetProgramiv( program, GL_INFO_LOG_LENGTH, &max_length );
+
+      std::cerr << " ======= Shader Program log ======= \n";
+      std::vector<GLchar> error_log(max_length + 1, '\0');
+      glGetProgramInfoLog( program, max_length, &max_length, &error_log[0] );
+      std::cerr << error_log.data() << "\n";
+   }
+   return linked == GL_TRUE;
+}
+
+std::string ShaderGL::getResourceName(GLenum program_interface, GLuint index, GLint max_name_length) const
+{
+   GLsizei length = 0;
+   std::vector<GLchar> name(max_name_length + 1, '\0');
+   glGetProgramResourceName( ShaderProgram, program_interface, index, max_name_length + 1, &length, name.data() );
+   return std::string(name.data(), length);
+}
+
+void ShaderGL::reflectActiveUniforms()
+{
+   GLint uniform_num = 0, max_name_length = 0;
+   glGetProgramInterfaceiv( ShaderProgram, GL_UNIFORM, GL_ACTIVE_RESOURCES, &uniform_num );
+   glGetProgramInterfaceiv( ShaderProgram, GL_UNIFORM, GL_MAX_NAME_LENGTH, &max_name_length );
+
+   const std::array<GLenum, 4> properties = { GL_LOCATION, GL_TYPE, GL_ARRAY_SIZE, GL_BLOCK_INDEX };
+   for (GLint i = 0; i < uniform_num; ++i) {
+      std::array<GLint, 4> values{};
+      glGetProgramResourceiv(
+         ShaderProgram, GL_UNIFORM, static_cast<GLuint>(i),
+         static_cast<GLsizei>(properties.size()), properties.data(),
+         static_cast<GLsizei>(values.size()), nullptr, values.data()
+      );
+
+      // The members of uniform and storage blocks do not have locations. They are accessed through the block.
+      if (values[3] != -1) continue;
+
+      const auto type = static_cast<GLenum>(values[1]);
+      const std::string name = getResourceName( GL_UNIFORM, static_cast<GLuint>(i), max_name_length );
+      ActiveUniforms[name] = UniformInfo( values[0], type, values[2] );
+
+      // An array is reported once as "name[0]", and its elements have consecutive locations.
+      const size_t bracket = name.rfind( "[0]" );
+      if (bracket != std::string::npos && bracket + 3 == name.size()) {
+         const std::string array_name = name.substr( 0, bracket );
+         ActiveUniforms[array_name] = UniformInfo( values[0], type, values[2] );
+         for (GLint e = 1; e < values[2]; ++e) {
+            ActiveUniforms[array_name + "[" + std::to_string( e ) + "]"] = UniformInfo( values[0] + e, type, 1 );
+         }
+      }
+   }
+}
+
+void ShaderGL::reflectActiveBlocks(GLenum program_interface, std::unordered_map<std::string, BlockInfo>& blocks) const
+{
+   GLint block_num = 0, max_name_length = 0;
+   glGetProgramInterfaceiv( ShaderProgram, program_interface, GL_ACTIVE_RESOURCES, &block_num );
+   glGetProgramInterfaceiv( ShaderProgram, program_interface, GL_MAX_NAME_LENGTH, &max_name_length );
+
+   const std::array<GLenum, 2> properties = { GL_BUFFER_BINDING, GL_BUFFER_DATA_SIZE };
+   for (GLint i = 0; i < block_num; ++i) {
+      std::array<GLint, 2> values{};
+      glGetProgramResourceiv(
+         ShaderProgram, program_interface, static_cast<GLuint>(i),
+         static_cast<GLsizei>(properties.size()), properties.data(),
+         static_cast<GLsizei>(values.size()), nullptr, values.data()
+      );
+      blocks[getResourceName( program_interface, static_cast<GLuint>(i), max_name_length )] = BlockInfo( values[0], values[1] );
+   }
+}
+
+void ShaderGL::reflectShaderProgram()
+{
+   ActiveUniforms.clear();
+   UniformBlocks.clear();
+   StorageBlocks.clear();
+   reflectActiveUniforms();
+   reflectActiveBlocks( GL_UNIFORM_BLOCK, UniformBlocks );
+   reflectActiveBlocks( GL_SHADER_STORAGE_BLOCK, StorageBlocks );
+}
+
+bool ShaderGL::hasResourceNames() const
+{
+   return ActiveUniforms.find( "" ) == ActiveUniforms.end() &&
+      UniformBlocks.find( "" ) == UniformBlocks.end() &&
+      StorageBlocks.find( "" ) == StorageBlocks.end();
+}
+
+bool ShaderGL::linkShaderProgram(bool use_binaries)
+{
+   std::vector<GLuint> shaders;
+   if (use_binaries) {
+      for (const auto& file : ShaderFiles) {
+         const GLuint shader = getSpecializedShader( file.first, file.second );
+         if (shader == 0) break;
+         shaders.emplace_back( shader );
+      }
+
+      // SPIR-V and GLSL shaders cannot be linked together, so every stage falls back to GLSL if any binary is missing.
+      if (shaders.size() != ShaderFiles.size()) {
+         for (const auto& shader : shaders) glDeleteShader( shader );
+         shaders.clear();
+         use_binaries = false;
+      }
+   }
+   if (!use_binaries) {
+      for (const auto& file : ShaderFiles) {
+         const GLuint shader = getCompiledShader( file.first, file.second );
+         if (shader == 0) {
+            for (const auto& compiled : shaders) glDeleteShader( compiled );
+            return false;
+         }
+         shaders.emplace_back( shader );
+      }
+   }
+
+   const GLuint program = glCreateProgram();
+   for (const auto& shader : shaders) glAttachShader( program, shader );
+   glLinkProgram( program );
+   for (const auto& shader : shaders) glDeleteShader( shader );
+   if (!checkLinkError( program )) {
+      std::cerr << "Could not link shader program\n";
+      glDeleteProgram( program );
+      return false;
+   }
+
+   if (ShaderProgram != 0) glDeleteProgram( ShaderProgram );
+   ShaderProgram = program;
+   LoadedFromBinaries = use_binaries;
+   reflectShaderProgram();
+   return true;
+}
+
+bool ShaderGL::buildShaderProgram()
+{
+   if (!linkShaderProgram( true )) return false;
+
+   // The uniform locations are found by name, so the binaries are only usable if the driver keeps the SPIR-V names.
+   if (LoadedFromBinaries && !hasResourceNames()) {
+      std::cerr << "The driver does not reflect SPIR-V names: compiling GLSL sources instead\n";
+      return linkShaderProgram( false );
+   }
+   return true;
+}
+
 void ShaderGL::setShader(
    const char* vertex_shader_path,
    const char* fragment_shader_path,
@@ -83,79 +342,202 @@ void ShaderGL::setShader(
    const char* tessellation_evaluation_shader_path
 )
 {
-   const GLuint vertex_shader = getCompiledShader( GL_VERTEX_SHADER, vertex_shader_path );
-   const GLuint fragment_shader = getCompiledShader( GL_FRAGMENT_SHADER, fragment_shader_path );
-   const GLuint geometry_shader = getCompiledShader( GL_GEOMETRY_SHADER, geometry_shader_path );
-   const GLuint tessellation_control_shader = getCompiledShader( GL_TESS_CONTROL_SHADER, tessellation_control_shader_path );
-   const GLuint tessellation_evaluation_shader = getCompiledShader( GL_TESS_EVALUATION_SHADER, tessellation_evaluation_shader_path );
-   ShaderProgram = glCreateProgram();
-   glAttachShader( ShaderProgram, vertex_shader );
-   glAttachShader( ShaderProgram, fragment_shader );
-   if (geometry_shader != 0) glAttachShader( ShaderProgram, geometry_shader );
-   if (tessellation_control_shader != 0) glAttachShader( ShaderProgram, tessellation_control_shader );
-   if (tessellation_evaluation_shader != 0) glAttachShader( ShaderProgram, tessellation_evaluation_shader );
-   glLinkProgram( ShaderProgram );
-   glDeleteShader( vertex_shader );
-   glDeleteShader( fragment_shader );
-   if (geometry_shader != 0) glDeleteShader( geometry_shader );
-   if (tessellation_control_shader != 0) glDeleteShader( tessellation_control_shader );
-   if (tessellation_evaluation_shader != 0) glDeleteShader( tessellation_evaluation_shader );
+   ShaderFiles.clear();
+   ShaderFiles.emplace_back( GL_VERTEX_SHADER, vertex_shader_path );
+   ShaderFiles.emplace_back( GL_FRAGMENT_SHADER, fragment_shader_path );
+   if (geometry_shader_path != nullptr) ShaderFiles.emplace_back( GL_GEOMETRY_SHADER, geometry_shader_path );
+   if (tessellation_control_shader_path != nullptr) {
+      ShaderFiles.emplace_back( GL_TESS_CONTROL_SHADER, tessellation_control_shader_path );
+   }
+   if (tessellation_evaluation_shader_path != nullptr) {
+      ShaderFiles.emplace_back( GL_TESS_EVALUATION_SHADER, tessellation_evaluation_shader_path );
+   }
+   buildShaderProgram();
 }
 
 void ShaderGL::setComputeShaders(const char* compute_shader_path)
 {
-   const GLuint compute_shader = getCompiledShader( GL_COMPUTE_SHADER, compute_shader_path );
-   ShaderProgram = glCreateProgram();
-   glAttachShader( ShaderProgram, compute_shader );
-   glLinkProgram( ShaderProgram );
-   glDeleteShader( compute_shader );
+   ShaderFiles.clear();
+   ShaderFiles.emplace_back( GL_COMPUTE_SHADER, compute_shader_path );
+   buildShaderProgram();
 }
 
-void ShaderGL::setBasicTransformationUniforms()
+bool ShaderGL::isExtensionSupported(const std::string& extension)
 {
-   Location.World = glGetUniformLocation( ShaderProgram, "WorldMatrix" );
-   Location.View = glGetUniformLocation( ShaderProgram, "ViewMatrix" );
-   Location.Projection = glGetUniformLocation( ShaderProgram, "ProjectionMatrix" );
-   Location.ModelViewProjection = glGetUniformLocation( ShaderProgram, "ModelViewProjectionMatrix" );
+   GLint extension_num = 0;
+   glGetIntegerv( GL_NUM_EXTENSIONS, &extension_num );
+   for (GLint i = 0; i < extension_num; ++i) {
+      if (extension == reinterpret_cast<const char*>(glGetStringi( GL_EXTENSIONS, static_cast<GLuint>(i) ))) return true;
+   }
+   return false;
 }
 
-void ShaderGL::setBasicUniformLocations()
+void ShaderGL::enableHotReload()
 {
-   setBasicTransformationUniforms();
+#ifdef __linux__
+   ParallelCompileSupported =
+      isExtensionSupported( "GL_KHR_parallel_shader_compile" ) || isExtensionSupported( "GL_ARB_parallel_shader_compile" );
+
+   if (WatchDescriptor < 0) WatchDescriptor = inotify_init1( IN_NONBLOCK | IN_CLOEXEC );
+   if (WatchDescriptor < 0) {
+      std::cerr << "Could not initialize inotify for shader hot-reload\n";
+      return;
+   }
 
-   Location.Texture[0] = glGetUniformLocation( ShaderProgram, "BaseTexture" );
-   Location.UseTexture = glGetUniformLocation( ShaderProgram, "UseTexture" );
+   // Editors often save by replacing the file, so the directories are watched rather than the files.
+   for (const auto& file : ShaderFiles) {
+      const size_t slash = file.second.find_last_of( '/' );
+      const std::string directory = slash == std::string::npos ? "." : file.second.substr( 0, slash );
+      const int watch = inotify_add_watch( WatchDescriptor, directory.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO );
+      if (watch < 0) std::cerr << "Could not watch shader directory " << directory << "\n";
+      else WatchedDirectories[watch] = directory;
+   }
+#else
+   std::cerr << "Shader hot-reload is only supported on Linux\n";
+#endif
 }
 
-void ShaderGL::setUniformLocations(int light_num)
+void ShaderGL::readFileEvents()
 {
-   setBasicTransformationUniforms();
+#ifdef __linux__
+   alignas(inotify_event) char buffer[4096];
+   while (true) {
+      const ssize_t length = read( WatchDescriptor, buffer, sizeof( buffer ) );
+      if (length <= 0) break;
+
+      for (ssize_t i = 0; i < length;) {
+         const auto* event = reinterpret_cast<const inotify_event*>(buffer + i);
+         i += static_cast<ssize_t>(sizeof( inotify_event ) + event->len);
 
-   Location.MaterialEmission = glGetUniformLocation( ShaderProgram, "Material.EmissionColor" );
-   Location.MaterialAmbient = glGetUniformLocation( ShaderProgram, "Material.AmbientColor" );
-   Location.MaterialDiffuse = glGetUniformLocation( ShaderProgram, "Material.DiffuseColor" );
-   Location.MaterialSpecular = glGetUniformLocation( ShaderProgram, "Material.SpecularColor" );
-   Location.MaterialSpecularExponent = glGetUniformLocation( ShaderProgram, "Material.SpecularExponent" );
+         const auto directory = WatchedDirectories.find( event->wd );
+         if (event->len == 0 || directory == WatchedDirectories.end()) continue;
 
-   Location.Texture[0] = glGetUniformLocation( ShaderProgram, "BaseTexture" );
-   Location.UseTexture = glGetUniformLocation( ShaderProgram, "UseTexture" );
+         const std::string path = directory->second + "/" + event->name;
+         for (const auto& file : ShaderFiles) {
+            if (file.second == path) ReloadRequested = true;
+         }
+      }
+   }
+#endif
+}
+
+void ShaderGL::requestReload()
+{
+   ReloadRequested = false;
 
-   Location.UseLight = glGetUniformLocation( ShaderProgram, "UseLight" );
-   Location.LightNum = glGetUniformLocation( ShaderProgram, "LightNum" );
-   Location.GlobalAmbient = glGetUniformLocation( ShaderProgram, "GlobalAmbient" );
+   // The binaries are stale once a source has changed, so the sources are compiled.
+   // Only the compilation is started here. The result is checked in the following frames not to stall the current one.
+   PendingProgram = glCreateProgram();
+   for (const auto& file : ShaderFiles) {
+      std::string shader_contents;
+      readShaderFile( shader_contents, file.second.c_str() );
+      insertShaderConstants( shader_contents );
 
-   Location.Lights.resize( light_num );
-   for (int i = 0; i < light_num; ++i) {
-      Location.Lights[i].LightSwitch = glGetUniformLocation( ShaderProgram, std::string("Lights[" + std::to_string( i ) + "].LightSwitch").c_str() );
-      Location.Lights[i].LightPosition = glGetUniformLocation( ShaderProgram, std::string("Lights[" + std::to_string( i ) + "].Position").c_str() );
-      Location.Lights[i].LightAmbient = glGetUniformLocation( ShaderProgram, std::string("Lights[" + std::to_string( i ) + "].AmbientColor").c_str() );
-      Location.Lights[i].LightDiffuse = glGetUniformLocation( ShaderProgram, std::string("Lights[" + std::to_string( i ) + "].DiffuseColor").c_str() );
-      Location.Lights[i].LightSpecular = glGetUniformLocation( ShaderProgram, std::string("Lights[" + std::to_string( i ) + "].SpecularColor").c_str() );
-      Location.Lights[i].SpotlightDirection = glGetUniformLocation( ShaderProgram, std::string("Lights[" + std::to_string( i ) + "].SpotlightDirection").c_str() );
-      Location.Lights[i].SpotlightCutoffAngle = glGetUniformLocation( ShaderProgram, std::string("Lights[" + std::to_string( i ) + "].SpotlightCutoffAngle").c_str() );
-      Location.Lights[i].SpotlightFeather = glGetUniformLocation( ShaderProgram, std::string("Lights[" + std::to_string( i ) + "].SpotlightFeather").c_str() );
-      Location.Lights[i].LightFallOffRadius = glGetUniformLocation( ShaderProgram, std::string("Lights[" + std::to_string( i ) + "].FallOffRadius").c_str() );
+      const GLuint shader = glCreateShader( file.first );
+      const char* shader_source = shader_contents.c_str();
+      glShaderSource( shader, 1, &shader_source, nullptr );
+      glCompileShader( shader );
+      glAttachShader( PendingProgram, shader );
+      PendingShaders.emplace_back( file.first, shader );
    }
+   glLinkProgram( PendingProgram );
+}
+
+bool ShaderGL::finishReload()
+{
+   // Without parallel shader compilation, the following status queries wait for the compilation and link.
+   if (ParallelCompileSupported) {
+      GLint completed = GL_FALSE;
+      glGetProgramiv( PendingProgram, GL_COMPLETION_STATUS_KHR, &completed );
+      if (completed == GL_FALSE) return false;
+   }
+
+   bool compiled = true;
+   for (const auto& shader : PendingShaders) {
+      if (checkCompileError( shader.first, shader.second )) glDeleteShader( shader.second );
+      else compiled = false;
+   }
+   PendingShaders.clear();
+
+   if (!compiled || !checkLinkError( PendingProgram )) {
+      std::cerr << "Could not reload shader program " << ShaderProgram << ": keeping the previous one\n";
+      glDeleteProgram( PendingProgram );
+      PendingProgram = 0;
+      return false;
+   }
+
+   if (ShaderProgram != 0) glDeleteProgram( ShaderProgram );
+   ShaderProgram = PendingProgram;
+   PendingProgram = 0;
+   LoadedFromBinaries = false;
+   reflectShaderProgram();
+   updateLocations();
+   std::cout << "Shader program " << ShaderProgram << " reloaded\n";
+   return true;
+}
+
+bool ShaderGL::updateHotReload()
+{
+   if (WatchDescriptor < 0) return false;
+
+   readFileEvents();
+   if (PendingProgram != 0) return finishReload();
+   if (ReloadRequested) requestReload();
+   return false;
+}
+
+void ShaderGL::updateLocations()
+{
+   if (UsesMaterialLocations) setUniformLocations();
+   else if (!Locations.empty()) setBasicUniformLocations();
+
+   for (auto& location : CustomLocations) {
+      location.second = getUniformLocation( location.first );
+   }
+}
+
+void ShaderGL::setLocation(LocationIndex index, const char* name, bool optional)
+{
+   Locations[index] = getUniformLocation( name );
+   if (Locations[index] < 0 && !optional) {
+      std::cerr << "Uniform '" << name << "' is not an active uniform of program " << ShaderProgram << "\n";
+   }
+}
+
+void ShaderGL::setBasicTransformationUniforms()
+{
+   if (Locations.size() < LocationNum) Locations.resize( LocationNum, -1 );
+
+   // The shadow map passes only need the world matrix, because they are projected by the lights in the geometry shaders.
+   setLocation( WorldLoc, "WorldMatrix" );
+   setLocation( ViewLoc, "ViewMatrix", true );
+   setLocation( ProjectionLoc, "ProjectionMatrix", true );
+   setLocation( ModelViewProjectionLoc, "ModelViewProjectionMatrix", true );
+}
+
+void ShaderGL::setBasicUniformLocations()
+{
+   setBasicTransformationUniforms();
+
+   // The passes which only write the depth do not sample the textures.
+   setLocation( BaseTextureLoc, "BaseTexture", true );
+   setLocation( UseTextureLoc, "UseTexture", true );
+}
+
+void ShaderGL::setUniformLocations()
+{
+   UsesMaterialLocations = true;
+   setBasicUniformLocations();
+
+   setLocation( MaterialEmissionLoc, "Material.EmissionColor" );
+   setLocation( MaterialAmbientLoc, "Material.AmbientColor" );
+   setLocation( MaterialDiffuseLoc, "Material.DiffuseColor" );
+   setLocation( MaterialSpecularLoc, "Material.SpecularColor" );
+   setLocation( MaterialSpecularExponentLoc, "Material.SpecularExponent" );
+
+   setLocation( ObjectLightIndexOffsetLoc, "ObjectLightIndexOffset" );
+   setLocation( ObjectLightIndexNumLoc, "ObjectLightIndexNum" );
+   setLocation( ReceiveShadowsLoc, "ReceiveShadows" );
 }
 
 void ShaderGL::transferBasicTransformationUniforms(const glm::mat4& to_world, const CameraGL* camera, bool use_texture) const
@@ -163,13 +545,10 @@ void ShaderGL::transferBasicTransformationUniforms(const glm::mat4& to_world, co
    const glm::mat4 view = camera->getViewMatrix();
    const glm::mat4 projection = camera->getProjectionMatrix();
    const glm::mat4 model_view_projection = projection * view * to_world;
-   glUniformMatrix4fv( Location.World, 1, GL_FALSE, &to_world[0][0] );
-   glUniformMatrix4fv( Location.View, 1, GL_FALSE, &view[0][0] );
-   glUniformMatrix4fv( Location.Projection, 1, GL_FALSE, &projection[0][0] );
-   glUniformMatrix4fv( Location.ModelViewProjection, 1, GL_FALSE, &model_view_projection[0][0] );
-
-   for (const auto& texture : Location.Texture) {
-      glUniform1i( texture.second, texture.first );
-   }
-   glUniform1i( Location.UseTexture, use_texture ? 1 : 0 );
+   glUniformMatrix4fv( Locations[WorldLoc], 1, GL_FALSE, &to_world[0][0] );
+   glUniformMatrix4fv( Locations[ViewLoc], 1, GL_FALSE, &view[0][0] );
+   glUniformMatrix4fv( Locations[ProjectionLoc], 1, GL_FALSE, &projection[0][0] );
+   glUniformMatrix4fv( Locations[ModelViewProjectionLoc], 1, GL_FALSE, &model_view_projection[0][0] );
+   glUniform1i( Locations[BaseTextureLoc], 0 );
+   glUniform1i( Locations[UseTextureLoc], use_texture ? 1 : 0 );
 }
\ No newline at end of file
@@ -0,0 +1,225 @@
+#include "shadow_atlas.h"
+
+static_assert( sizeof( ShadowAtlasGL::ShadowInfo ) == 96, "ShadowInfo should match the std430 layout" );
+
+ShadowAtlasGL::ShadowAtlasGL(int atlas_size, int min_tile_size, GLenum depth_format) :
+   AtlasSize( atlas_size ), MinTileSize( min_tile_size ), MaxTileSize( atlas_size / 2 ), ShadowCapacity( 0 ),
+   DepthFormat( depth_format ), ReversedZ( false ), FBO( 0 ), DepthTextureID( 0 ), StaticFBO( 0 ), StaticDepthTextureID( 0 ), RawDepthSampler( 0 ), ShadowBuffer( 0 )
+{
+}
+
+ShadowAtlasGL::~ShadowAtlasGL()
+{
+   deleteAtlas();
+   if (RawDepthSampler != 0) glDeleteSamplers( 1, &RawDepthSampler );
+   if (ShadowBuffer != 0) glDeleteBuffers( 1, &ShadowBuffer );
+}
+
+void ShadowAtlasGL::deleteAtlas()
+{
+   if (DepthTextureID != 0) glDeleteTextures( 1, &DepthTextureID );
+   if (FBO != 0) glDeleteFramebuffers( 1, &FBO );
+   if (StaticDepthTextureID != 0) glDeleteTextures( 1, &StaticDepthTextureID );
+   if (StaticFBO != 0) glDeleteFramebuffers( 1, &StaticFBO );
+   DepthTextureID = FBO = StaticDepthTextureID = StaticFBO = 0;
+}
+
+void ShadowAtlasGL::createDepthTexture(GLuint& texture, GLuint& framebuffer, int size, GLenum depth_format, bool reversed_z)
+{
+   glCreateTextures( GL_TEXTURE_2D, 1, &texture );
+   glTextureStorage2D( texture, 1, depth_format, size, size );
+   glTextureParameteri( texture, GL_TEXTURE_MIN_FILTER, GL_LINEAR );
+   glTextureParameteri( texture, GL_TEXTURE_MAG_FILTER, GL_LINEAR );
+   glTextureParameteri( texture, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE );
+   glTextureParameteri( texture, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE );
+   glTextureParameteri( texture, GL_TEXTURE_COMPARE_MODE, GL_COMPARE_REF_TO_TEXTURE );
+   glTextureParameteri( texture, GL_TEXTURE_COMPARE_FUNC, reversed_z ? GL_GEQUAL : GL_LEQUAL );
+
+   glCreateFramebuffers( 1, &framebuffer );
+   glNamedFramebufferTexture( framebuffer, GL_DEPTH_ATTACHMENT, texture, 0 );
+}
+
+void ShadowAtlasGL::createAtlas()
+{
+   createDepthTexture( DepthTextureID, FBO, AtlasSize, DepthFormat, ReversedZ );
+   createDepthTexture( StaticDepthTextureID, StaticFBO, AtlasSize, DepthFormat, ReversedZ );
+
+   // The blocker search of the soft shadows needs the depth itself, so the atlas is also bound through this sampler.
+   if (RawDepthSampler == 0) {
+      glCreateSamplers( 1, &RawDepthSampler );
+      glSamplerParameteri( RawDepthSampler, GL_TEXTURE_MIN_FILTER, GL_NEAREST );
+      glSamplerParameteri( RawDepthSampler, GL_TEXTURE_MAG_FILTER, GL_NEAREST );
+      glSamplerParameteri( RawDepthSampler, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE );
+      glSamplerParameteri( RawDepthSampler, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE );
+      glSamplerParameteri( RawDepthSampler, GL_TEXTURE_COMPARE_MODE, GL_NONE );
+   }
+}
+
+void ShadowAtlasGL::setLightProjection(int light_index, const CameraGL* light_camera)
+{
+   ShadowInfo& shadow = Shadows[light_index];
+   shadow.ViewProjectionMatrix = light_camera->getProjectionMatrix() * light_camera->getViewMatrix();
+   shadow.TanHalfFov = 1.0f / light_camera->getProjectionMatrix()[1][1];
+   shadow.DepthRange = glm::vec2(light_camera->getNearPlane(), light_camera->getFarPlane());
+}
+
+void ShadowAtlasGL::recreateAtlas(int atlas_size, GLenum depth_format, bool reversed_z)
+{
+   // The tiles are forgotten, so every light is allocated and rendered again as if it had a new tile.
+   deleteAtlas();
+   AtlasSize = atlas_size;
+   MaxTileSize = std::max( atlas_size / 2, MinTileSize );
+   DepthFormat = depth_format;
+   ReversedZ = reversed_z;
+   Tiles.clear();
+   Shadows.clear();
+   createAtlas();
+}
+
+void ShadowAtlasGL::clearStaticTile(int light_index) const
+{
+   const glm::ivec4& tile = Tiles[light_index];
+   const float farthest = ReversedZ ? 0.0f : 1.0f;
+   glClearTexSubImage(
+      StaticDepthTextureID, 0, tile.x, tile.y, 0, tile.z, tile.w, 1, GL_DEPTH_COMPONENT, GL_FLOAT, &farthest
+   );
+}
+
+void ShadowAtlasGL::copyStaticTile(int light_index) const
+{
+   const glm::ivec4& tile = Tiles[light_index];
+   glCopyImageSubData(
+      StaticDepthTextureID, GL_TEXTURE_2D, 0, tile.x, tile.y, 0,
+      DepthTextureID, GL_TEXTURE_2D, 0, tile.x, tile.y, 0,
+      tile.z, tile.w, 1
+   );
+}
+
+float ShadowAtlasGL::getScreenCoverage(const glm::vec3& center, float radius, const CameraGL* camera)
+{
+   // The ratio of the projected diameter of the sphere to the viewport height.
+   const float distance = glm::length( center - camera->getCameraPosition() );
+   if (distance <= radius) return 1.0f;
+
+   const float projected_radius = radius * camera->getProjectionMatrix()[1][1] / std::sqrt( distance * distance - radius * radius );
+   return std::min( projected_radius, 1.0f );
+}
+
+int ShadowAtlasGL::getTileSize(float screen_coverage) const
+{
+   const float desired_size = screen_coverage * static_cast<float>(MaxTileSize);
+   int tile_size = MinTileSize;
+   while (tile_size < MaxTileSize && static_cast<float>(tile_size) < desired_size) tile_size *= 2;
+   return tile_size;
+}
+
+int ShadowAtlasGL::allocateNode(int node_index, int tile_size)
+{
+   if (Nodes[node_index].Used || Nodes[node_index].Size < tile_size) return -1;
+
+   if (Nodes[node_index].FirstChild < 0) {
+      if (Nodes[node_index].Size == tile_size) {
+         Nodes[node_index].Used = true;
+         return node_index;
+      }
+
+      const glm::ivec2 origin = Nodes[node_index].Origin;
+      const int half_size = Nodes[node_index].Size / 2;
+      Nodes[node_index].FirstChild = static_cast<int>(Nodes.size());
+      Nodes.emplace_back( origin, half_size );
+      Nodes.emplace_back( origin + glm::ivec2(half_size, 0), half_size );
+      Nodes.emplace_back( origin + glm::ivec2(0, half_size), half_size );
+      Nodes.emplace_back( origin + glm::ivec2(half_size, half_size), half_size );
+   }
+
+   const int first_child = Nodes[node_index].FirstChild;
+   for (int i = 0; i < 4; ++i) {
+      const int allocated = allocateNode( first_child + i, tile_size );
+      if (allocated >= 0) return allocated;
+   }
+   return -1;
+}
+
+void ShadowAtlasGL::reserveShadowBuffer()
+{
+   const auto light_num = static_cast<int>(Shadows.size());
+   if (ShadowBuffer != 0 && light_num <= ShadowCapacity) return;
+
+   ShadowCapacity = std::max( 64, ShadowCapacity );
+   while (ShadowCapacity < light_num) ShadowCapacity *= 2;
+   if (ShadowBuffer != 0) glDeleteBuffers( 1, &ShadowBuffer );
+
+   glCreateBuffers( 1, &ShadowBuffer );
+   glNamedBufferStorage(
+      ShadowBuffer,
+      static_cast<GLsizeiptr>(sizeof( ShadowInfo ) * ShadowCapacity),
+      nullptr,
+      GL_DYNAMIC_STORAGE_BIT
+   );
+}
+
+void ShadowAtlasGL::allocateTiles(std::vector<TileRequest> requests, int light_num)
+{
+   // The quadtree packs power-of-two tiles without any waste when the larger ones are placed first.
+   std::stable_sort(
+      requests.begin(), requests.end(),
+      [](const TileRequest& a, const TileRequest& b) { return a.TileSize > b.TileSize; }
+   );
+
+   Nodes.clear();
+   Nodes.emplace_back( glm::ivec2(0, 0), AtlasSize );
+   const std::vector<glm::ivec4> previous_tiles = std::move( Tiles );
+   Tiles.assign( light_num, glm::ivec4(0) );
+   const std::vector<ShadowInfo> previous_shadows = std::move( Shadows );
+   Shadows.assign( light_num, ShadowInfo{} );
+   const float inverse_atlas_size = 1.0f / static_cast<float>(AtlasSize);
+   for (const auto& request : requests) {
+      // A light which does not fit gets a smaller tile rather than no shadow at all.
+      int node_index = -1;
+      for (int tile_size = request.TileSize; tile_size >= MinTileSize && node_index < 0; tile_size /= 2) {
+         node_index = allocateNode( 0, tile_size );
+      }
+      if (node_index < 0) continue;
+
+      const QuadNode& node = Nodes[node_index];
+      Tiles[request.LightIndex] = glm::ivec4(node.Origin, node.Size, node.Size);
+
+      ShadowInfo& shadow = Shadows[request.LightIndex];
+      shadow.ViewProjectionMatrix = request.ViewProjectionMatrix;
+      shadow.AtlasRect = glm::vec4(glm::vec2(node.Origin), glm::vec2(static_cast<float>(node.Size))) * inverse_atlas_size;
+      shadow.HasShadow = 1;
+   }
+
+   // The cached depth of a light is lost when it moves to another tile. Otherwise, the light keeps the projection
+   // its cached depth was rendered with until the depth is refreshed.
+   ChangedTiles.assign( light_num, true );
+   ChangedProjections.assign( light_num, false );
+   for (int i = 0; i < light_num && i < static_cast<int>(previous_tiles.size()); ++i) {
+      ChangedTiles[i] = Tiles[i] != previous_tiles[i];
+      if (ChangedTiles[i]) continue;
+
+      ChangedProjections[i] = Shadows[i].ViewProjectionMatrix != previous_shadows[i].ViewProjectionMatrix;
+      Shadows[i] = previous_shadows[i];
+   }
+}
+
+void ShadowAtlasGL::uploadShadowBuffer()
+{
+   if (Shadows.empty()) return;
+   reserveShadowBuffer();
+   glNamedBufferSubData( ShadowBuffer, 0, static_cast<GLsizeiptr>(sizeof( ShadowInfo ) * Shadows.size()), Shadows.data() );
+}
+
+void ShadowAtlasGL::transferUniformsToShader(const ShaderGL* shader) const
+{
+   const GLint binding = shader->getStorageBlockBinding( "ShadowBuffer" );
+   if (binding >= 0) glBindBufferBase( GL_SHADER_STORAGE_BUFFER, static_cast<GLuint>(binding), ShadowBuffer );
+   glBindTextureUnit( 1, DepthTextureID );
+   bindRawDepthTexture( 5 );
+}
+
+void ShadowAtlasGL::bindRawDepthTexture(GLuint unit) const
+{
+   glBindTextureUnit( unit, DepthTextureID );
+   glBindSampler( unit, RawDepthSampler );
+}
\ No newline at end of file
@@ -0,0 +1,108 @@
+#include "shadow_scheduler.h"
+
+ShadowSchedulerGL::ShadowSchedulerGL(float budget_in_ms) :
+   BudgetInMs( budget_in_ms ), FrameIndex( 0 ), ActiveLightIndex( -1 )
+{
+}
+
+ShadowSchedulerGL::~ShadowSchedulerGL()
+{
+   for (const auto& query : FreeQueries) glDeleteQueries( 1, &query );
+   for (const auto& query : PendingQueries) glDeleteQueries( 1, &query.first );
+}
+
+void ShadowSchedulerGL::resize(int light_num)
+{
+   if (light_num <= static_cast<int>(LastUpdateFrames.size())) return;
+
+   LastUpdateFrames.resize( light_num, -1 );
+   CostsInMs.resize( light_num, -1.0f );
+   StaticPending.resize( light_num, true );
+}
+
+float ShadowSchedulerGL::getCost(int light_index) const
+{
+   if (CostsInMs[light_index] >= 0.0f) return CostsInMs[light_index];
+
+   // A light which has never been measured is assumed to cost as much as the others on average.
+   float sum = 0.0f;
+   int count = 0;
+   for (const auto& cost : CostsInMs) {
+      if (cost < 0.0f) continue;
+      sum += cost;
+      ++count;
+   }
+   return count > 0 ? sum / static_cast<float>(count) : DefaultCostInMs;
+}
+
+void ShadowSchedulerGL::collectTimings()
+{
+   // The results are read a few frames late, when they are available, so that the CPU never waits for the GPU.
+   auto it = PendingQueries.begin();
+   for (; it != PendingQueries.end(); ++it) {
+      GLint available = GL_FALSE;
+      glGetQueryObjectiv( it->first, GL_QUERY_RESULT_AVAILABLE, &available );
+      if (available == GL_FALSE) break;
+
+      GLuint64 elapsed_in_ns = 0;
+      glGetQueryObjectui64v( it->first, GL_QUERY_RESULT, &elapsed_in_ns );
+      const float elapsed_in_ms = static_cast<float>(elapsed_in_ns) * 1e-6f;
+      float& cost = CostsInMs[it->second];
+      cost = cost < 0.0f ? elapsed_in_ms : glm::mix( cost, elapsed_in_ms, CostSmoothing );
+      FreeQueries.emplace_back( it->first );
+   }
+   PendingQueries.erase( PendingQueries.begin(), it );
+   ++FrameIndex;
+}
+
+std::vector<int> ShadowSchedulerGL::schedule(std::vector<Candidate> candidates)
+{
+   // The lights which lost their maps come first, and the rest are ranked by how visible, how fast-changing,
+   // and how stale their shadows are.
+   const auto getPriority = [this](const Candidate& candidate) {
+      const int last_update = LastUpdateFrames[candidate.LightIndex];
+      const auto staleness = static_cast<float>(last_update < 0 ? FrameIndex : FrameIndex - last_update);
+      return candidate.Importance * (1.0f + StalenessWeight * staleness) * (candidate.IsMoving ? MotionWeight : 1.0f);
+   };
+   std::stable_sort(
+      candidates.begin(), candidates.end(),
+      [&getPriority](const Candidate& a, const Candidate& b) {
+         if (a.IsMandatory != b.IsMandatory) return a.IsMandatory;
+         return getPriority( a ) > getPriority( b );
+      }
+   );
+
+   std::vector<int> scheduled;
+   float spent_in_ms = 0.0f;
+   for (const auto& candidate : candidates) {
+      const float cost = getCost( candidate.LightIndex );
+      // At least one light is refreshed every frame, so that every shadow gets updated eventually.
+      if (!candidate.IsMandatory && !scheduled.empty() && spent_in_ms + cost > BudgetInMs) continue;
+
+      scheduled.emplace_back( candidate.LightIndex );
+      spent_in_ms += cost;
+   }
+   return scheduled;
+}
+
+void ShadowSchedulerGL::beginUpdate(int light_index)
+{
+   if (FreeQueries.empty()) {
+      GLuint query;
+      glCreateQueries( GL_TIME_ELAPSED, 1, &query );
+      FreeQueries.emplace_back( query );
+   }
+   const GLuint query = FreeQueries.back();
+   FreeQueries.pop_back();
+   PendingQueries.emplace_back( query, light_index );
+   glBeginQuery( GL_TIME_ELAPSED, query );
+   ActiveLightIndex = light_index;
+}
+
+void ShadowSchedulerGL::endUpdate()
+{
+   glEndQuery( GL_TIME_ELAPSED );
+   LastUpdateFrames[ActiveLightIndex] = FrameIndex;
+   StaticPending[ActiveLightIndex] = false;
+   ActiveLightIndex = -1;
+}
\ No newline at end of file
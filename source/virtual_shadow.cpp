@@ -0,0 +1,357 @@
+#include "virtual_shadow.h"
+
+VirtualShadowGL::VirtualShadowGL(int pool_size, int max_pages_per_frame, GLenum depth_format) :
+   Enabled( false ), ReversedZ( false ), PageTableDirty( true ), HasNewRequests( false ), PoolSize( pool_size ),
+   MaxPagesPerFrame( max_pages_per_frame ), LightIndex( -1 ), FrameIndex( 0 ), FrameNum( 0 ), TotalRequestedPageNum( 0 ),
+   TotalHitPageNum( 0 ), TotalRenderedPageNum( 0 ), DepthFormat( depth_format ), FBO( 0 ), PoolTextureID( 0 ),
+   PageTableBuffer( 0 ), RequestBuffer( 0 ), ReadbackBuffer( 0 ), ReadbackFence( nullptr ), ViewProjectionMatrix( 1.0f )
+{
+}
+
+VirtualShadowGL::~VirtualShadowGL()
+{
+   deletePool();
+   if (PageTableBuffer != 0) glDeleteBuffers( 1, &PageTableBuffer );
+   if (RequestBuffer != 0) glDeleteBuffers( 1, &RequestBuffer );
+   if (ReadbackBuffer != 0) glDeleteBuffers( 1, &ReadbackBuffer );
+   if (ReadbackFence != nullptr) glDeleteSync( ReadbackFence );
+}
+
+void VirtualShadowGL::deletePool()
+{
+   if (PoolTextureID != 0) glDeleteTextures( 1, &PoolTextureID );
+   if (FBO != 0) glDeleteFramebuffers( 1, &FBO );
+   PoolTextureID = FBO = 0;
+}
+
+void VirtualShadowGL::createPool()
+{
+   // The physical pages are tiles of one ordinary depth texture, so no sparse texture is needed
+   // and the page table does the indirection in the shader.
+   glCreateTextures( GL_TEXTURE_2D, 1, &PoolTextureID );
+   glTextureStorage2D( PoolTextureID, 1, DepthFormat, PoolSize, PoolSize );
+   glTextureParameteri( PoolTextureID, GL_TEXTURE_MIN_FILTER, GL_LINEAR );
+   glTextureParameteri( PoolTextureID, GL_TEXTURE_MAG_FILTER, GL_LINEAR );
+   glTextureParameteri( PoolTextureID, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE );
+   glTextureParameteri( PoolTextureID, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE );
+   glTextureParameteri( PoolTextureID, GL_TEXTURE_COMPARE_MODE, GL_COMPARE_REF_TO_TEXTURE );
+   glTextureParameteri( PoolTextureID, GL_TEXTURE_COMPARE_FUNC, ReversedZ ? GL_GEQUAL : GL_LEQUAL );
+
+   glCreateFramebuffers( 1, &FBO );
+   glNamedFramebufferTexture( FBO, GL_DEPTH_ATTACHMENT, PoolTextureID, 0 );
+
+   if (PageTableBuffer == 0) {
+      glCreateBuffers( 1, &PageTableBuffer );
+      glNamedBufferStorage(
+         PageTableBuffer, sizeof( GLuint ) * VirtualPageNum * VirtualPageNum, nullptr, GL_DYNAMIC_STORAGE_BIT
+      );
+      glCreateBuffers( 1, &RequestBuffer );
+      glNamedBufferStorage( RequestBuffer, sizeof( GLuint ) * RequestWordNum, nullptr, GL_DYNAMIC_STORAGE_BIT );
+      glCreateBuffers( 1, &ReadbackBuffer );
+      glNamedBufferStorage( ReadbackBuffer, sizeof( GLuint ) * RequestWordNum, nullptr, GL_DYNAMIC_STORAGE_BIT );
+   }
+
+   const int pool_page_num = getPoolPageNum();
+   PhysicalPageOwners.assign( pool_page_num * pool_page_num, -1 );
+   LastRequestedFrames.assign( pool_page_num * pool_page_num, -1 );
+   PageTable.assign( VirtualPageNum * VirtualPageNum, UnmappedPage );
+   PageTableDirty = true;
+}
+
+void VirtualShadowGL::recreatePool(GLenum depth_format, bool reversed_z)
+{
+   // Every cached page follows the previous format and depth convention, so all of them are rendered again.
+   deletePool();
+   DepthFormat = depth_format;
+   ReversedZ = reversed_z;
+   createPool();
+}
+
+void VirtualShadowGL::setEnabled(bool enabled)
+{
+   // The light and the casters are not tracked while it is off, so the cached pages cannot be trusted anymore.
+   Enabled = enabled;
+   if (Enabled) invalidateAllPages();
+   RequestedPages.clear();
+   RenderingPages.clear();
+   HasNewRequests = false;
+   resetStatistics();
+}
+
+void VirtualShadowGL::resetStatistics()
+{
+   FrameNum = 0;
+   TotalRequestedPageNum = TotalHitPageNum = TotalRenderedPageNum = 0;
+}
+
+int VirtualShadowGL::getResidentPageNum() const
+{
+   return static_cast<int>(std::count_if(
+      PhysicalPageOwners.begin(), PhysicalPageOwners.end(), [](int owner) { return owner >= 0; }
+   ));
+}
+
+glm::ivec2 VirtualShadowGL::getPhysicalPageOffset(GLuint physical_page) const
+{
+   const auto pool_page_num = static_cast<GLuint>(getPoolPageNum());
+   return PageSize * glm::ivec2(physical_page % pool_page_num, physical_page / pool_page_num);
+}
+
+glm::mat4 VirtualShadowGL::getVirtualViewProjection(const glm::vec3& light_direction, const std::array<glm::vec3, 2>& scene_bounds) const
+{
+   const glm::vec3 up = std::abs( light_direction.y ) > 0.99f ? glm::vec3(1.0f, 0.0f, 0.0f) : glm::vec3(0.0f, 1.0f, 0.0f);
+   const glm::mat4 light_view = lookAt( glm::vec3(0.0f), light_direction, up );
+   glm::vec3 min_point(std::numeric_limits<float>::max()), max_point(std::numeric_limits<float>::lowest());
+   for (int i = 0; i < 8; ++i) {
+      const glm::vec3 corner(scene_bounds[i & 1].x, scene_bounds[(i >> 1) & 1].y, scene_bounds[(i >> 2) & 1].z);
+      const glm::vec3 point = glm::vec3(light_view * glm::vec4(corner, 1.0f));
+      min_point = glm::min( min_point, point );
+      max_point = glm::max( max_point, point );
+   }
+
+   // The map is square so that its texels are, and one more step around the snapped bounds keeps the scene inside.
+   const glm::vec2 center = glm::round( 0.5f * glm::vec2(min_point + max_point) / BoundsStep ) * BoundsStep;
+   const float half_size =
+      std::ceil( 0.5f * std::max( max_point.x - min_point.x, max_point.y - min_point.y ) / BoundsStep ) * BoundsStep + BoundsStep;
+   const float near_plane = std::floor( -max_point.z / BoundsStep ) * BoundsStep - BoundsStep;
+   const float far_plane = std::ceil( -min_point.z / BoundsStep ) * BoundsStep + BoundsStep;
+   const glm::mat4 projection = CameraGL::getOrthographicProjection(
+      center.x - half_size, center.x + half_size, center.y - half_size, center.y + half_size,
+      near_plane, far_plane, ReversedZ
+   );
+   return projection * light_view;
+}
+
+glm::mat4 VirtualShadowGL::getPageViewProjection(int virtual_page) const
+{
+   // The page is cropped out of the virtual map by scaling its part of the NDC to the whole viewport.
+   const auto page_num = static_cast<float>(VirtualPageNum);
+   const glm::vec2 page(virtual_page % VirtualPageNum, virtual_page / VirtualPageNum);
+   const glm::vec2 center = (2.0f * page + 1.0f) / page_num - 1.0f;
+   glm::mat4 crop(1.0f);
+   crop[0][0] = crop[1][1] = page_num;
+   crop[3][0] = -page_num * center.x;
+   crop[3][1] = -page_num * center.y;
+   return crop * ViewProjectionMatrix;
+}
+
+void VirtualShadowGL::unmapPage(int virtual_page)
+{
+   const GLuint physical_page = PageTable[virtual_page];
+   if (physical_page == UnmappedPage) return;
+
+   PhysicalPageOwners[physical_page] = -1;
+   LastRequestedFrames[physical_page] = -1;
+   PageTable[virtual_page] = UnmappedPage;
+   PageTableDirty = true;
+}
+
+void VirtualShadowGL::invalidatePages(const glm::vec4& bounding_sphere)
+{
+   // The map is orthographic, so the caster covers the pages under the square around its projected bounding sphere.
+   const glm::vec4 center = ViewProjectionMatrix * glm::vec4(glm::vec3(bounding_sphere), 1.0f);
+   const glm::vec2 radius = bounding_sphere.w * glm::vec2(
+      glm::length( glm::vec3(ViewProjectionMatrix[0][0], ViewProjectionMatrix[1][0], ViewProjectionMatrix[2][0]) ),
+      glm::length( glm::vec3(ViewProjectionMatrix[0][1], ViewProjectionMatrix[1][1], ViewProjectionMatrix[2][1]) )
+   );
+   const auto page_num = static_cast<float>(VirtualPageNum);
+   const glm::ivec2 first = glm::clamp(
+      glm::ivec2(glm::floor( (0.5f * (glm::vec2(center) - radius) + 0.5f) * page_num )), 0, VirtualPageNum - 1
+   );
+   const glm::ivec2 last = glm::clamp(
+      glm::ivec2(glm::floor( (0.5f * (glm::vec2(center) + radius) + 0.5f) * page_num )), 0, VirtualPageNum - 1
+   );
+   for (int y = first.y; y <= last.y; ++y) {
+      for (int x = first.x; x <= last.x; ++x) unmapPage( y * VirtualPageNum + x );
+   }
+}
+
+void VirtualShadowGL::invalidateAllPages()
+{
+   std::fill( PageTable.begin(), PageTable.end(), UnmappedPage );
+   std::fill( PhysicalPageOwners.begin(), PhysicalPageOwners.end(), -1 );
+   std::fill( LastRequestedFrames.begin(), LastRequestedFrames.end(), -1 );
+   PageTableDirty = true;
+}
+
+void VirtualShadowGL::collectRequests()
+{
+   // The fence is only polled, so that the CPU never waits for the GPU, and the last requests are kept meanwhile.
+   if (ReadbackFence == nullptr) return;
+   const GLenum status = glClientWaitSync( ReadbackFence, 0, 0 );
+   if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED) return;
+   glDeleteSync( ReadbackFence );
+   ReadbackFence = nullptr;
+
+   std::array<GLuint, RequestWordNum> requests{};
+   glGetNamedBufferSubData( ReadbackBuffer, 0, sizeof( GLuint ) * RequestWordNum, requests.data() );
+   RequestedPages.clear();
+   for (int i = 0; i < RequestWordNum; ++i) {
+      for (int bit = 0; bit < 32; ++bit) {
+         if ((requests[i] >> bit) & 1u) RequestedPages.emplace_back( i * 32 + bit );
+      }
+   }
+   HasNewRequests = true;
+}
+
+void VirtualShadowGL::mapRequestedPages()
+{
+   // The requested pages which are resident are hits. The missing ones take the free physical pages first,
+   // then the least recently requested ones, and the rest of them wait for the following frames.
+   std::vector<int> missing_pages;
+   int hit_num = 0;
+   for (const auto& page : RequestedPages) {
+      const GLuint physical_page = PageTable[page];
+      if (physical_page == UnmappedPage) missing_pages.emplace_back( page );
+      else {
+         LastRequestedFrames[physical_page] = FrameIndex;
+         ++hit_num;
+      }
+   }
+   // The same requests are mapped every frame until the next readback, but they are counted only once,
+   // so that the hit rate does not depend on the readback latency.
+   if (HasNewRequests) {
+      TotalRequestedPageNum += static_cast<long long>(RequestedPages.size());
+      TotalHitPageNum += hit_num;
+      HasNewRequests = false;
+   }
+   if (missing_pages.empty()) return;
+
+   std::vector<int> evictable_pages;
+   for (int i = 0; i < static_cast<int>(LastRequestedFrames.size()); ++i) {
+      if (LastRequestedFrames[i] != FrameIndex) evictable_pages.emplace_back( i );
+   }
+   std::stable_sort(
+      evictable_pages.begin(), evictable_pages.end(),
+      [this](int a, int b) { return LastRequestedFrames[a] < LastRequestedFrames[b]; }
+   );
+
+   const int map_num = std::min(
+      { static_cast<int>(missing_pages.size()), static_cast<int>(evictable_pages.size()), MaxPagesPerFrame }
+   );
+   for (int i = 0; i < map_num; ++i) {
+      const int physical_page = evictable_pages[i];
+      const int owner = PhysicalPageOwners[physical_page];
+      if (owner >= 0) PageTable[owner] = UnmappedPage;
+
+      PhysicalPageOwners[physical_page] = missing_pages[i];
+      LastRequestedFrames[physical_page] = FrameIndex;
+      PageTable[missing_pages[i]] = static_cast<GLuint>(physical_page);
+      RenderingPages.emplace_back( missing_pages[i] );
+   }
+   TotalRenderedPageNum += map_num;
+   PageTableDirty = true;
+}
+
+void VirtualShadowGL::updatePages(const LightGL* lights, const std::array<glm::vec3, 2>& scene_bounds, const std::vector<ObjectGL*>& casters)
+{
+   ++FrameIndex;
+   ++FrameNum;
+   RenderingPages.clear();
+   LightIndex = -1;
+   for (int i = 0; i < lights->getTotalLightNum(); ++i) {
+      if (lights->getShadowType( i ) == LightGL::ShadowType::Cascaded) {
+         LightIndex = i;
+         break;
+      }
+   }
+   if (LightIndex < 0) return;
+
+   // Unlike the cascades, the virtual map does not follow the camera, so a page stays valid
+   // until the light or the casters over it change.
+   const glm::vec3 light_direction = -glm::normalize( glm::vec3(lights->getLightPosition( LightIndex )) );
+   const glm::mat4 view_projection = getVirtualViewProjection( light_direction, scene_bounds );
+   if (lights->isShadowDirty( LightIndex ) || view_projection != ViewProjectionMatrix) {
+      ViewProjectionMatrix = view_projection;
+      invalidateAllPages();
+   }
+
+   // A moved caster leaves its old footprint and covers a new one, so the pages under both are rendered again.
+   CasterSpheres.resize( casters.size(), glm::vec4(0.0f, 0.0f, 0.0f, -1.0f) );
+   for (size_t i = 0; i < casters.size(); ++i) {
+      const glm::vec4 sphere = casters[i]->getBoundingSphereInWorld();
+      if (casters[i]->isDirty()) {
+         if (CasterSpheres[i].w >= 0.0f) invalidatePages( CasterSpheres[i] );
+         invalidatePages( sphere );
+      }
+      CasterSpheres[i] = sphere;
+   }
+   mapRequestedPages();
+}
+
+void VirtualShadowGL::transferPageUniformsToShader(const ShaderGL* shader, int batch) const
+{
+   // Each page of the batch is cleared and gets its own viewport in the pool, so that the geometry shader
+   // routes every triangle to the pages it overlaps.
+   const int first = batch * PagesPerBatch;
+   const int page_num = std::min( PagesPerBatch, static_cast<int>(RenderingPages.size()) - first );
+   const float farthest = ReversedZ ? 0.0f : 1.0f;
+   std::array<glm::mat4, PagesPerBatch> view_projections{};
+   std::array<GLfloat, PagesPerBatch * 4> viewports{};
+   for (int i = 0; i < page_num; ++i) {
+      const int virtual_page = RenderingPages[first + i];
+      const glm::ivec2 offset = getPhysicalPageOffset( PageTable[virtual_page] );
+      glClearTexSubImage(
+         PoolTextureID, 0, offset.x, offset.y, 0, PageSize, PageSize, 1, GL_DEPTH_COMPONENT, GL_FLOAT, &farthest
+      );
+      view_projections[i] = getPageViewProjection( virtual_page );
+      viewports[i * 4] = static_cast<GLfloat>(offset.x);
+      viewports[i * 4 + 1] = static_cast<GLfloat>(offset.y);
+      viewports[i * 4 + 2] = viewports[i * 4 + 3] = static_cast<GLfloat>(PageSize);
+   }
+   glViewportArrayv( 0, page_num, viewports.data() );
+   glUniformMatrix4fv(
+      shader->getUniformLocation( "PageViewProjectionMatrices" ), page_num, GL_FALSE, &view_projections[0][0][0]
+   );
+   glUniform1i( shader->getUniformLocation( "PageNum" ), page_num );
+}
+
+void VirtualShadowGL::uploadPageTable()
+{
+   if (!PageTableDirty) return;
+
+   glNamedBufferSubData(
+      PageTableBuffer, 0, static_cast<GLsizeiptr>(sizeof( GLuint ) * PageTable.size()), PageTable.data()
+   );
+   PageTableDirty = false;
+}
+
+void VirtualShadowGL::markPages(const ShaderGL* marking_shader, GLuint depth_texture, const CameraGL* camera)
+{
+   // Every visible pixel flags the virtual page it looks up, and the flags are read back like the depth bounds.
+   glClearNamedBufferData( RequestBuffer, GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT, nullptr );
+
+   glUseProgram( marking_shader->getShaderProgram() );
+   const GLint binding = marking_shader->getStorageBlockBinding( "PageRequestBuffer" );
+   if (binding >= 0) glBindBufferBase( GL_SHADER_STORAGE_BUFFER, static_cast<GLuint>(binding), RequestBuffer );
+   const glm::mat4 inverse_view_projection = glm::inverse( camera->getProjectionMatrix() * camera->getViewMatrix() );
+   glUniformMatrix4fv(
+      marking_shader->getUniformLocation( "InverseViewProjectionMatrix" ), 1, GL_FALSE, &inverse_view_projection[0][0]
+   );
+   glUniformMatrix4fv(
+      marking_shader->getUniformLocation( "VirtualViewProjectionMatrix" ), 1, GL_FALSE, &ViewProjectionMatrix[0][0]
+   );
+   glUniform1f( marking_shader->getUniformLocation( "FarDepth" ), camera->isReversedZ() ? 0.0f : 1.0f );
+   glBindTextureUnit( 0, depth_texture );
+   glDispatchCompute(
+      static_cast<GLuint>((camera->getWidth() + ThreadGroupSize - 1) / ThreadGroupSize),
+      static_cast<GLuint>((camera->getHeight() + ThreadGroupSize - 1) / ThreadGroupSize),
+      1
+   );
+   glMemoryBarrier( GL_BUFFER_UPDATE_BARRIER_BIT );
+
+   if (ReadbackFence != nullptr) return;
+   glCopyNamedBufferSubData( RequestBuffer, ReadbackBuffer, 0, 0, sizeof( GLuint ) * RequestWordNum );
+   ReadbackFence = glFenceSync( GL_SYNC_GPU_COMMANDS_COMPLETE, 0 );
+}
+
+void VirtualShadowGL::transferUniformsToShader(const ShaderGL* shader) const
+{
+   const GLint binding = shader->getStorageBlockBinding( "PageTableBuffer" );
+   if (binding >= 0) glBindBufferBase( GL_SHADER_STORAGE_BUFFER, static_cast<GLuint>(binding), PageTableBuffer );
+   glBindTextureUnit( 7, PoolTextureID );
+   glUniformMatrix4fv(
+      shader->getUniformLocation( "VirtualViewProjectionMatrix" ), 1, GL_FALSE, &ViewProjectionMatrix[0][0]
+   );
+   glUniform1i( shader->getUniformLocation( "VirtualShadowLight" ), Enabled ? LightIndex : -1 );
+}
\ No newline at end of file